@@ -0,0 +1,14 @@
+TEMPLATE = subdirs
+
+SUBDIRS += src \
+           bench \
+           allocations \
+           collector \
+           tests
+
+src.file            = src/QLogger.pro
+bench.depends       = src
+allocations.subdir  = bench/allocations
+allocations.depends = src
+collector.depends   = src
+tests.depends       = src
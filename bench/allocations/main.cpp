@@ -0,0 +1,278 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+
+#include "qlogger.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+/*
+ *  Allocation and contention profile of QLogger.
+ *  malloc() and friends are replaced for the whole process, QLogger and Qt
+ *  included, to count the heap allocations made by the producers for each
+ *  message and by the other threads, i.e. the writers. Contention comes from
+ *  QLogger::statistics(). Every configuration prints a JSON object on a line
+ *  of its own, like qlogger-bench.
+ *  Build the library with QT_NO_DEBUG_OUTPUT, see QLogger.pro: the Qt messages
+ *  QLogger still emits allocate whatever the handler does. How many reached
+ *  the handler is reported as trace_messages, which must be 0.
+ */
+
+#ifdef __GLIBC__
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void* pointer);
+}
+
+namespace {
+
+std::atomic<quint64>    total_allocations(0);   //!< allocations of every thread
+thread_local quint64    thread_allocations = 0; //!< allocations of the current thread
+
+inline void countAllocation()
+{
+    total_allocations.fetch_add(1, std::memory_order_relaxed);
+    ++thread_allocations;
+}
+
+}
+
+extern "C" {
+
+void* malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+    countAllocation();
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer != nullptr ? 0 : ENOMEM;
+}
+
+void free(void* pointer)
+{
+    __libc_free(pointer);
+}
+
+}
+
+#endif
+
+namespace {
+
+std::atomic<quint64>    trace_messages(0);  //!< Qt messages emitted while profiling
+
+/*!
+ *  \brief Thread adding messages and counting its own allocations
+ */
+class Producer : public QThread
+{
+public:
+    using add_function = std::function<void(QLogger&, int)>;
+
+    Producer(QLogger* logger, QSemaphore* go, const add_function& add, int messages) :
+        _logger(logger), _go(go), _add(add), _messages(messages), _allocations(0) {}
+
+    quint64 allocations() const { return _allocations; }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        _go->acquire();
+#ifdef __GLIBC__
+        const quint64 before = thread_allocations;
+#endif
+        for (int i = 0; i < _messages; ++i)
+            _add(*_logger, i);
+#ifdef __GLIBC__
+        _allocations = thread_allocations - before;
+#endif
+    }
+
+private:
+    QLogger*        _logger;
+    QSemaphore*     _go;
+    add_function    _add;
+    int             _messages;
+    quint64         _allocations;   //!< allocations made while adding
+};
+
+/*!
+ *  \brief A way of setting up and feeding the logger
+ */
+struct Configuration {
+    QString                             name;       //!< name in the report
+    std::function<void(QLogger&)>       setup;      //!< called before starting the logger
+    Producer::add_function              add;        //!< adds the i-th message
+};
+
+void report(const QJsonObject& result)
+{
+    const QByteArray line = QJsonDocument(result).toJson(QJsonDocument::Compact);
+    fprintf(stdout, "%s\n", line.constData());
+    fflush(stdout);
+}
+
+void profile(const Configuration& configuration, int producers, int messages)
+{
+    QLogger logger(QLogger::stream_ptr(new QLoggerNullStream));
+    if (configuration.setup)
+        configuration.setup(logger);
+    logger.start();
+
+    const int per_producer = qMax(messages / producers, 1);
+
+    QSemaphore go;
+    std::vector<std::unique_ptr<Producer>> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back(new Producer(&logger, &go, configuration.add, per_producer));
+        threads.back()->start();
+    }
+
+#ifdef __GLIBC__
+    const quint64 total_before = total_allocations.load();
+    const quint64 main_before  = thread_allocations;
+#endif
+    const quint64 traces_before = trace_messages.load();
+    go.release(producers);
+    for (auto& thread : threads)
+        thread->wait();
+    logger.flush().waitForFinished();
+#ifdef __GLIBC__
+    const quint64 total = total_allocations.load() - total_before;
+    const quint64 main  = thread_allocations - main_before;
+#else
+    const quint64 total = 0;
+    const quint64 main  = 0;
+#endif
+    const quint64 traces = trace_messages.load() - traces_before;
+
+    logger.finishWriting();
+    logger.wait();
+
+    quint64 producer_allocations = 0;
+    for (auto& thread : threads)
+        producer_allocations += thread->allocations();
+
+    const QLogger::Statistics statistics = logger.statistics();
+    const double added = static_cast<double>(per_producer) * producers;
+
+    QJsonObject result;
+    result.insert("configuration",                  configuration.name);
+    result.insert("producers",                      producers);
+    result.insert("messages",                       added);
+    result.insert("producer_allocations_per_message", producer_allocations / added);
+    // everything else but the main thread, which only waits: the writer threads
+    result.insert("writer_allocations_per_message", (total - producer_allocations - main) / added);
+    result.insert("contention_ratio",               statistics.enqueued != 0
+                  ? static_cast<double>(statistics.producer_waits) / statistics.enqueued : 0.0);
+    result.insert("wait_ns_per_message",            statistics.producer_wait_time / added);
+    result.insert("wait_ns_per_contended_call",     statistics.producer_waits != 0
+                  ? static_cast<double>(statistics.producer_wait_time) / statistics.producer_waits : 0.0);
+    result.insert("trace_messages",                 static_cast<double>(traces));
+    report(result);
+}
+
+void silence(QtMsgType, const QMessageLogContext&, const QString&)
+{
+    trace_messages.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    qInstallMessageHandler(silence);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("QLogger allocation and contention profile, one JSON object per line");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("messages", "Messages per configuration.", "count", "100000"));
+    parser.addOption(QCommandLineOption("producers", "Number of producer threads of the contended runs.",
+                                        "count", QString::number(QThread::idealThreadCount())));
+    parser.process(app);
+
+#ifndef __GLIBC__
+    fprintf(stderr, "malloc can be interposed only with glibc\n");
+    return 1;
+#endif
+
+    const int messages  = qMax(parser.value("messages").toInt(), 1);
+    const int producers = qMax(parser.value("producers").toInt(), 1);
+    const QString message(100, QChar('x'));
+
+    const Producer::add_function info = [message](QLogger& logger, int) {
+        logger.addMessage(message, QLogger::LogLevel::Info);
+    };
+
+    QList<Configuration> configurations;
+    configurations.append({"default", nullptr, info});
+    configurations.append({"category", nullptr, [message](QLogger& logger, int) {
+        logger.addMessage(message, QLogger::LogLevel::Info, "bench.category");
+    }});
+    configurations.append({"fields", nullptr, [message](QLogger& logger, int i) {
+        logger.addMessage(message, QLogger::LogLevel::Info, {{"index", i}, {"source", "bench"}});
+    }});
+    configurations.append({"record", nullptr, [](QLogger& logger, int i) {
+        logger.record(QLogger::LogLevel::Info) << "message " << i << " of the bench, " << i * 0.5 << " done";
+    }});
+    configurations.append({"fan_out", [](QLogger& logger) {
+        logger.addStream(QLogger::stream_ptr(new QLoggerNullStream));
+        logger.addStream(QLogger::stream_ptr(new QLoggerNullStream), QLogger::LogLevel::Info, true);
+    }, info});
+    configurations.append({"priority", nullptr, [message](QLogger& logger, int i) {
+        logger.addMessage(message, i % 10 == 0 ? QLogger::LogLevel::Fatal : QLogger::LogLevel::Info);
+    }});
+    configurations.append({"flight_recorder", [](QLogger& logger) {
+        logger.setFlightRecorder(QLogger::LogLevel::Warning, 4096);
+    }, info});
+    configurations.append({"crash_journal", [](QLogger& logger) {
+        logger.enableCrashHandler();
+    }, info});
+
+    for (const Configuration& configuration : configurations) {
+        profile(configuration, 1, messages);
+        if (producers > 1)
+            profile(configuration, producers, messages);
+    }
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+QT       -= gui
+QT       += network
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TARGET = qlogger-bench
+TEMPLATE = app
+
+INCLUDEPATH += ../src
+LIBS += -L$$OUT_PWD/../src -lQLogger
+
+SOURCES += main.cpp
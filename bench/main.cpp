@@ -0,0 +1,423 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "qlogger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+#ifdef Q_OS_UNIX
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#  include <cstring>
+#endif
+
+/*
+ *  Benchmarks of QLogger.
+ *  Every run prints a JSON object on a line of its own, so results of
+ *  different commits can be compared with any JSON tool.
+ *  For meaningful numbers build the library with QT_NO_DEBUG_OUTPUT,
+ *  see QLogger.pro.
+ */
+
+namespace {
+
+qint64 monotonicNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ *  \brief Loopback server draining what a QLoggerSocketStream sends
+ */
+class LoopbackServer : public QThread
+{
+public:
+    LoopbackServer() : _port(0) {}
+
+    /*!
+     *  \brief Starts listening on an ephemeral port
+     *  \return the port, 0 if listening failed
+     */
+    quint16 listen()
+    {
+        start();
+        _ready.acquire();
+        return _port;
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        QTcpServer server;
+        if (server.listen(QHostAddress::LocalHost, 0))
+            _port = server.serverPort();
+        _ready.release();
+
+        if (_port == 0 || !server.waitForNewConnection(30000))
+            return;
+
+        std::unique_ptr<QTcpSocket> socket(server.nextPendingConnection());
+        socket->setParent(nullptr);
+        while (socket->state() == QAbstractSocket::ConnectedState || socket->bytesAvailable() > 0) {
+            if (socket->bytesAvailable() > 0 || socket->waitForReadyRead(100))
+                socket->readAll();
+        }
+    }
+
+private:
+    QSemaphore  _ready;     //!< released once listening
+    quint16     _port;      //!< port listened on
+};
+
+#ifdef Q_OS_UNIX
+/*!
+ *  \brief Receiver draining what a QLoggerUnixSocketStream sends, a recv() per message
+ */
+class UnixServer : public QThread
+{
+public:
+    UnixServer(const QString& path, QLoggerUnixSocketStream::Mode mode) :
+        _path(QFile::encodeName(path)), _mode(mode), _listener(-1) {}
+
+    ~UnixServer()
+    {
+        if (_listener != -1)
+            ::close(_listener);
+        ::unlink(_path.constData());
+    }
+
+    /*!
+     *  \brief Starts listening
+     *  \return false if listening failed
+     */
+    bool listen()
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, _path.constData(), sizeof(address.sun_path) - 1);
+        ::unlink(_path.constData());
+
+        _listener = socket(AF_UNIX, _mode == QLoggerUnixSocketStream::Mode::SeqPacket ? SOCK_SEQPACKET
+                                                                                     : SOCK_STREAM, 0);
+        if (_listener == -1 || bind(_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+                || ::listen(_listener, 1) == -1)
+            return false;
+
+        start();
+        return true;
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        const int fd = accept(_listener, nullptr, nullptr);
+        if (fd == -1)
+            return;
+
+        char buffer[1 << 16];
+        while (recv(fd, buffer, sizeof(buffer), 0) > 0) {}
+        ::close(fd);
+    }
+
+private:
+    QByteArray                      _path;      //!< path of the socket
+    QLoggerUnixSocketStream::Mode   _mode;      //!< type of the socket
+    int                             _listener;  //!< listening socket
+};
+#endif
+
+/*!
+ *  \brief Thread adding messages as fast as it can
+ */
+class Producer : public QThread
+{
+public:
+    Producer(QLogger* logger, QSemaphore* go, const QString& message, int messages) :
+        _logger(logger), _go(go), _message(message), _messages(messages) {}
+
+    const QLoggerHistogram& callLatency() const { return _call_latency; }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        _go->acquire();
+        for (int i = 0; i < _messages; ++i) {
+            const qint64 start = monotonicNow();
+            _logger->addMessage(_message, QLogger::LogLevel::Info);
+            _call_latency.record(monotonicNow() - start);
+        }
+    }
+
+private:
+    QLogger*            _logger;
+    QSemaphore*         _go;
+    QString             _message;
+    int                 _messages;
+    QLoggerHistogram    _call_latency;  //!< duration of each addMessage()
+};
+
+struct Options {
+    int     messages;       //!< messages per run, split among the producers
+    int     max_producers;  //!< runs go from 1 producer up to this
+    int     message_size;   //!< characters per message
+    QString directory;      //!< where the file stream writes
+};
+
+void report(const QJsonObject& result)
+{
+    const QByteArray line = QJsonDocument(result).toJson(QJsonDocument::Compact);
+    fprintf(stdout, "%s\n", line.constData());
+    fflush(stdout);
+}
+
+/*!
+ *  \brief Runs producers against a logger writing in stream and reports the figures
+ *  \param name of the stream in the report
+ *  \param stream the stream to benchmark
+ *  \param producers number of producer threads
+ *  \param options
+ *  \param prepare called before starting the logger, e.g. to move a socket in its thread
+ *  \return false if the logger reported an error
+ */
+bool benchmark(const QString& name, QLogger::stream_ptr stream, int producers, const Options& options,
+               const std::function<void(QLogger&)>& prepare = std::function<void(QLogger&)>())
+{
+    QLogger logger(std::move(stream));
+    if (prepare)
+        prepare(logger);
+    logger.start();
+
+    const QString message(options.message_size, QChar('x'));
+    const int per_producer = qMax(options.messages / producers, 1);
+
+    QSemaphore go;
+    std::vector<std::unique_ptr<Producer>> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back(new Producer(&logger, &go, message, per_producer));
+        threads.back()->start();
+    }
+
+    const qint64 start = monotonicNow();
+    go.release(producers);
+    for (auto& thread : threads)
+        thread->wait();
+    const qint64 enqueued = monotonicNow();
+
+    const bool flushed = logger.flush(true).result();
+    const qint64 written = monotonicNow();
+
+    logger.finishWriting();
+    logger.wait();
+
+    QLoggerHistogram call_latency;
+    for (auto& thread : threads)
+        call_latency.merge(thread->callLatency());
+
+    const QLogger::Statistics statistics    = logger.statistics();
+    const QLoggerHistogram end_to_end       = logger.endToEndLatency();
+    const double seconds                    = (written - start) / 1e9;
+
+    QJsonObject result;
+    result.insert("stream",                 name);
+    result.insert("producers",              producers);
+    result.insert("messages",               static_cast<double>(statistics.written));
+    result.insert("message_size",           options.message_size);
+    result.insert("seconds",                seconds);
+    result.insert("enqueue_seconds",        (enqueued - start) / 1e9);
+    result.insert("messages_per_sec",       statistics.written / seconds);
+    result.insert("bytes",                  static_cast<double>(statistics.bytes));
+    result.insert("bytes_per_sec",          statistics.bytes / seconds);
+    result.insert("call_p50_ns",            static_cast<double>(call_latency.percentile(50)));
+    result.insert("call_p99_ns",            static_cast<double>(call_latency.percentile(99)));
+    result.insert("call_p999_ns",           static_cast<double>(call_latency.percentile(99.9)));
+    result.insert("call_max_ns",            static_cast<double>(call_latency.max()));
+    result.insert("e2e_p50_ns",             static_cast<double>(end_to_end.percentile(50)));
+    result.insert("e2e_p99_ns",             static_cast<double>(end_to_end.percentile(99)));
+    result.insert("e2e_p999_ns",            static_cast<double>(end_to_end.percentile(99.9)));
+    result.insert("e2e_max_ns",             static_cast<double>(end_to_end.max()));
+    result.insert("queue_high_water",       static_cast<double>(statistics.queue_high_water));
+    result.insert("producer_waits",         static_cast<double>(statistics.producer_waits));
+    result.insert("producer_wait_ns",       static_cast<double>(statistics.producer_wait_time));
+    result.insert("write_errors",           static_cast<double>(statistics.write_errors));
+    result.insert("ok",                     flushed && logger.errorString().isEmpty());
+    report(result);
+
+    return flushed && logger.errorString().isEmpty();
+}
+
+/*!
+ *  \brief Compares QLoggerJson with QJsonDocument encoding {"ts","level","msg"} lines
+ *  Messages are message_size characters long, escaped has one '"' every 10 characters.
+ */
+void benchmarkJsonEncoding(const Options& options, bool escaped)
+{
+    QString message(options.message_size, QChar('x'));
+    if (escaped) {
+        for (int i = 0; i < message.size(); i += 10)
+            message[i] = QChar('"');
+    }
+
+    const QString ts    = QDateTime::currentDateTime().toString(Qt::ISODateWithMs);
+    const QString level = "INFO";
+
+    const auto run = [&](const QString& encoder, const std::function<QByteArray()>& encode) {
+        qint64 bytes = 0;
+        const qint64 start = monotonicNow();
+        for (int i = 0; i < options.messages; ++i)
+            bytes += encode().size();
+        const double seconds = (monotonicNow() - start) / 1e9;
+
+        QJsonObject result;
+        result.insert("encoder",            encoder);
+        result.insert("escaped",            escaped);
+        result.insert("messages",           options.messages);
+        result.insert("message_size",       options.message_size);
+        result.insert("seconds",            seconds);
+        result.insert("messages_per_sec",   options.messages / seconds);
+        result.insert("bytes_per_sec",      bytes / seconds);
+        report(result);
+    };
+
+    run("qloggerjson", [&]() {
+        QByteArray line;
+        line.reserve(64 + message.size());
+        line += "{\"ts\":";
+        QLoggerJson::appendString(line, ts);
+        line += ",\"level\":";
+        QLoggerJson::appendString(line, level);
+        line += ",\"msg\":";
+        QLoggerJson::appendString(line, message);
+        line += "}\n";
+        return line;
+    });
+
+    run("qjsondocument", [&]() {
+        QJsonObject object;
+        object.insert("ts",     ts);
+        object.insert("level",  level);
+        object.insert("msg",    message);
+        return QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+    });
+}
+
+void silence(QtMsgType, const QMessageLogContext&, const QString&) {}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    qInstallMessageHandler(silence);    // QLogger's own traces would only add noise
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("QLogger benchmarks, one JSON object per line");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("messages", "Messages per run.", "count", "200000"));
+    parser.addOption(QCommandLineOption("producers", "Maximum number of producer threads.", "count",
+                                        QString::number(QThread::idealThreadCount())));
+    parser.addOption(QCommandLineOption("size", "Characters per message.", "count", "100"));
+    parser.addOption(QCommandLineOption("directory", "Directory of the file stream.", "path",
+                                        QDir::tempPath()));
+    parser.addOption(QCommandLineOption("streams", "Comma separated streams to run: null, memory, file, socket, "
+                                        "unix, a unix socket in both modes, and json, the JSON Lines output "
+                                        "on a null stream and its encoder against QJsonDocument.", "list",
+                                        "null,memory,file,socket,unix,json"));
+    parser.process(app);
+
+    Options options;
+    options.messages        = qMax(parser.value("messages").toInt(), 1);
+    options.max_producers   = qMax(parser.value("producers").toInt(), 1);
+    options.message_size    = qMax(parser.value("size").toInt(), 0);
+    options.directory       = parser.value("directory");
+
+    const QStringList streams = parser.value("streams").split(',');
+    bool ok = true;
+
+    // powers of 2 up to max_producers, which is always run
+    QList<int> producer_counts;
+    for (int producers = 1; producers < options.max_producers; producers *= 2)
+        producer_counts.append(producers);
+    producer_counts.append(options.max_producers);
+
+    if (streams.contains("json")) {
+        benchmarkJsonEncoding(options, false);
+        benchmarkJsonEncoding(options, true);
+    }
+
+    for (int producers : producer_counts) {
+        if (streams.contains("null"))
+            ok = benchmark("null", QLogger::stream_ptr(new QLoggerNullStream), producers, options) && ok;
+
+        if (streams.contains("memory")) {
+            const int capacity = options.messages * (options.message_size + 64);
+            ok = benchmark("memory", QLogger::stream_ptr(new QLoggerMemoryStream(capacity)),
+                           producers, options) && ok;
+        }
+
+        if (streams.contains("file")) {
+            const QString filename = QDir(options.directory).filePath(
+                        QString("qlogger-bench-%1.log").arg(QCoreApplication::applicationPid()));
+            QFile::remove(filename);
+
+            ok = benchmark("file", QLogger::stream_ptr(new QLoggerFileStream(filename)),
+                           producers, options) && ok;
+            QFile::remove(filename);
+        }
+
+        if (streams.contains("socket")) {
+            LoopbackServer server;
+            const quint16 port = server.listen();
+
+            QLoggerSocketStream::socket_ptr socket(new QTcpSocket);
+            ok = benchmark("socket", QLogger::stream_ptr(new QLoggerSocketStream(std::move(socket),
+                                                                                "127.0.0.1", port)),
+                           producers, options, [](QLogger& logger) {
+                static_cast<QLoggerSocketStream*>(logger.stream().get())->socket()->moveToThread(&logger);
+            }) && ok;
+            server.wait();
+        }
+
+#ifdef Q_OS_UNIX
+        if (streams.contains("unix")) {
+            const QString path = QDir(QDir::tempPath()).filePath(
+                        QString("qlogger-bench-%1.sock").arg(QCoreApplication::applicationPid()));
+            for (const QLoggerUnixSocketStream::Mode mode : {QLoggerUnixSocketStream::Mode::Stream,
+                                                             QLoggerUnixSocketStream::Mode::SeqPacket}) {
+                UnixServer server(path, mode);
+                if (!server.listen()) {
+                    ok = false;
+                    continue;
+                }
+
+                const QString name = mode == QLoggerUnixSocketStream::Mode::Stream ? "unix_stream"
+                                                                                   : "unix_seqpacket";
+                ok = benchmark(name, QLogger::stream_ptr(new QLoggerUnixSocketStream(path, mode)),
+                               producers, options) && ok;
+                server.wait();
+            }
+        }
+#endif
+
+        if (streams.contains("json")) {
+            ok = benchmark("null_json", QLogger::stream_ptr(new QLoggerNullStream), producers, options,
+                           [](QLogger& logger) {
+                logger.setOutputFormat(QLogger::OutputFormat::JsonLines);
+            }) && ok;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+QT       -= gui
+QT       += network
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TARGET = qlogger-collector
+TEMPLATE = app
+
+INCLUDEPATH += ../src
+LIBS += -L$$OUT_PWD/../src -lQLogger
+
+SOURCES += main.cpp \
+           socketcollector.cpp
+
+HEADERS += socketcollector.h
+
+unix {
+    target.path = /usr/bin
+    INSTALLS += target
+}
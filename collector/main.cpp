@@ -0,0 +1,250 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include "qlogger.h"
+#include "socketcollector.h"
+
+#include <csignal>
+#include <cstdio>
+#include <map>
+#include <memory>
+
+/*
+ *  Collector of the messages of other processes.
+ *  It reads the rings written by QLoggerSharedMemoryStream and appends each
+ *  of them to a file of its own, named after the segment, so the logging
+ *  processes never wait for the disk. Segments are given on the command line
+ *  and, on Linux, found in /dev/shm by their prefix. A segment is removed
+ *  once drained and its writing process gone.
+ *  With --listen it also serves QLoggerSocketStream clients, see SocketCollector,
+ *  and prints their throughput as JSON objects, one per line.
+ */
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;  //!< set by SIGINT and SIGTERM
+
+void requestStop(int)
+{
+    stop_requested = 1;
+}
+
+/*!
+ *  \brief A ring being collected and the file it goes to
+ */
+class SharedMemorySource
+{
+public:
+    static const int BatchSize = 1 << 20;   //!< bytes written to the file at once, at most
+
+    SharedMemorySource(const QString& name, const QString& filename) :
+        _reader(name), _file(filename), _dropped(0) {}
+
+    /*!
+     *  \brief Maps the segment and opens the file
+     *  \return false if either failed, the segment may not be initialized yet
+     */
+    bool open()
+    {
+        if (!_reader.open())
+            return false;
+
+        if (!_file.open(QIODevice::Append)) {
+            fprintf(stderr, "%s: %s\n", qPrintable(_file.fileName()), qPrintable(_file.errorString()));
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     *  \brief Moves what's waiting in the ring to the file with a single write
+     *  \return the number of messages collected
+     */
+    int collect()
+    {
+        _buffer.resize(0);
+        const int messages = _reader.read(_buffer, BatchSize);
+
+        const quint64 dropped = _reader.dropped();
+        if (dropped != _dropped) {
+            _buffer += QString("qlogger-collector: %1 messages dropped, the ring was full\n")
+                    .arg(dropped - _dropped).toUtf8();
+            _dropped = dropped;
+        }
+
+        if (!_buffer.isEmpty() && _file.write(_buffer) == -1)
+            fprintf(stderr, "%s: %s\n", qPrintable(_file.fileName()), qPrintable(_file.errorString()));
+        return messages;
+    }
+
+    void flush()
+    {
+        _file.flush();
+    }
+
+    /*!
+     *  \return true once the writing process is gone and everything has been collected
+     */
+    bool isOver() const
+    {
+        return _reader.isAbandoned() && _reader.isEmpty();
+    }
+
+    /*!
+     *  \brief Removes the segment and closes the file
+     *  The segment stays if a new writing process took it over since isOver(),
+     *  it's found again by the next scan.
+     */
+    void remove()
+    {
+        if (!_reader.remove())
+            fprintf(stderr, "%s: %s\n", qPrintable(_reader.name()), qPrintable(_reader.errorString()));
+        _reader.close();
+        _file.close();
+    }
+
+private:
+    QLoggerSharedMemoryReader   _reader;    //!< the ring
+    QFile                       _file;      //!< where the messages go
+    QByteArray                  _buffer;    //!< batch being written, kept to reuse its memory
+    quint64                     _dropped;   //!< drops already reported
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Writes the messages of QLoggerSharedMemoryStream rings and "
+                                     "QLoggerSocketStream clients in files");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("directory", "Directory of the files, one per segment.", "path", "."));
+    parser.addOption(QCommandLineOption("prefix", "Segments found in /dev/shm start with it, Linux only.",
+                                        "prefix", "qlogger"));
+    parser.addOption(QCommandLineOption("interval", "Longest sleep when all the rings are empty, in "
+                                        "milliseconds: from 1 ms it doubles while they stay empty.",
+                                        "msecs", "10"));
+    parser.addOption(QCommandLineOption("scan", "Milliseconds between two looks for new segments.",
+                                        "msecs", "1000"));
+    parser.addOption(QCommandLineOption("listen", "Port to accept QLoggerSocketStream connections on, Linux only.",
+                                        "port"));
+    parser.addOption(QCommandLineOption("address", "Address to listen on.", "address", "127.0.0.1"));
+    parser.addOption(QCommandLineOption("source", "What gets a file of its own among the socket clients: "
+                                        "connection or host.", "key", "connection"));
+    parser.addOption(QCommandLineOption("framing", "How the socket clients send their messages: lines or "
+                                        "length, for QLoggerSocketStream::Framing::LengthPrefixed.",
+                                        "framing", "lines"));
+    parser.addOption(QCommandLineOption("report", "Seconds between two throughput reports of the socket "
+                                        "clients, 0 for none.", "secs", "10"));
+    parser.addPositionalArgument("segments", "Names of segments to collect, e.g. /qlogger-server.",
+                                 "[segments...]");
+    parser.process(app);
+
+    const QDir directory(parser.value("directory"));
+    const QString prefix    = parser.value("prefix");
+    const int interval      = qMax(parser.value("interval").toInt(), 1);
+    const int scan          = qMax(parser.value("scan").toInt(), interval);
+    const int report        = qMax(parser.value("report").toInt(), 0);
+    const QStringList named = parser.positionalArguments();
+
+    std::unique_ptr<SocketCollector> sockets;
+    if (parser.isSet("listen")) {
+        const SocketCollector::SourceKey key = parser.value("source") == "host"
+                ? SocketCollector::SourceKey::Host : SocketCollector::SourceKey::Connection;
+        const int port = parser.value("listen").toInt();
+        const QLoggerSocketStream::Framing framing = parser.value("framing") == "length"
+                ? QLoggerSocketStream::Framing::LengthPrefixed : QLoggerSocketStream::Framing::Lines;
+        sockets.reset(new SocketCollector(directory, key, framing));
+        if (port <= 0 || port > 65535) {
+            fprintf(stderr, "invalid port %s\n", qPrintable(parser.value("listen")));
+            return 1;
+        }
+        if (!sockets->listen(parser.value("address"), static_cast<quint16>(port))) {
+            fprintf(stderr, "%s\n", qPrintable(sockets->errorString()));
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT,  requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    std::map<QString, std::unique_ptr<SharedMemorySource>> sources;
+    const auto add = [&](QString name) {
+        if (!name.startsWith(QChar('/')))
+            name.prepend(QChar('/'));
+        if (sources.count(name) != 0)
+            return;
+
+        std::unique_ptr<SharedMemorySource> source(
+                    new SharedMemorySource(name, directory.filePath(name.mid(1) + ".log")));
+        if (source->open())
+            sources[name] = std::move(source);
+    };
+
+    QElapsedTimer last_scan;
+    QElapsedTimer last_report;
+    last_report.start();
+    int idle_sleep = 1;     // milliseconds, backs off up to interval while there is nothing to collect
+    while (!stop_requested) {
+        if (!last_scan.isValid() || last_scan.elapsed() >= scan) {
+            for (const QString& name : named)
+                add(name);
+#ifdef Q_OS_LINUX
+            for (const QString& entry : QDir("/dev/shm").entryList(QStringList(prefix + "*"), QDir::Files))
+                add(entry);
+#endif
+            last_scan.start();
+        }
+
+        int collected = 0;
+        for (auto it = sources.begin(); it != sources.end();) {
+            collected += it->second->collect();
+            if (it->second->isOver()) {
+                it->second->flush();
+                it->second->remove();
+                it = sources.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        if (collected == 0) {
+            for (auto& source : sources)
+                source.second->flush();
+        }
+
+        // epoll_wait() is the sleep when serving sockets
+        qint64 received = 0;
+        if (sockets) {
+            received = sockets->poll(collected == 0 ? idle_sleep : 0);
+            if (received == 0)
+                sockets->flush();
+
+            if (report > 0 && last_report.elapsed() >= report * 1000) {
+                sockets->report(last_report.nsecsElapsed());
+                last_report.restart();
+            }
+        }
+        else if (collected == 0) {
+            QThread::msleep(static_cast<unsigned long>(idle_sleep));
+        }
+
+        idle_sleep = collected == 0 && received == 0 ? qMin(idle_sleep * 2, interval) : 1;
+    }
+
+    if (sockets)
+        sockets->flush();
+
+    for (auto& source : sources) {
+        while (source.second->collect() > 0) {}
+        source.second->flush();
+    }
+
+    return 0;
+}
@@ -0,0 +1,392 @@
+#include "socketcollector.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#  include <arpa/inet.h>
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <netinet/in.h>
+#  include <sys/epoll.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef Q_OS_LINUX
+QString errnoString(const char* function)
+{
+    return QString("%1: %2").arg(function).arg(QString::fromLocal8Bit(strerror(errno)));
+}
+
+/*!
+ *  \brief Formats the address of a peer
+ *  \param host set to the address alone
+ *  \return address:port, [address]:port for IPv6
+ */
+QString peerName(const sockaddr_storage& address, QString* host)
+{
+    char text[INET6_ADDRSTRLEN] = "";
+    quint16 port = 0;
+    if (address.ss_family == AF_INET6) {
+        const sockaddr_in6& in6 = reinterpret_cast<const sockaddr_in6&>(address);
+        inet_ntop(AF_INET6, &in6.sin6_addr, text, sizeof(text));
+        port = ntohs(in6.sin6_port);
+        *host = QString::fromLatin1(text);
+        return QString("[%1]:%2").arg(*host).arg(port);
+    }
+
+    const sockaddr_in& in = reinterpret_cast<const sockaddr_in&>(address);
+    inet_ntop(AF_INET, &in.sin_addr, text, sizeof(text));
+    port = ntohs(in.sin_port);
+    *host = QString::fromLatin1(text);
+    return QString("%1:%2").arg(*host).arg(port);
+}
+#endif
+
+void printJson(const QJsonObject& object)
+{
+    const QByteArray line = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    fprintf(stdout, "%s\n", line.constData());
+    fflush(stdout);
+}
+
+}
+
+SocketCollector::SocketCollector(const QDir &directory, SourceKey key, QLoggerSocketStream::Framing framing) :
+    _directory(directory), _key(key), _framing(framing), _epoll(-1), _listener(-1) {}
+
+SocketCollector::~SocketCollector()
+{
+    while (!_connections.empty())
+        close(_connections.begin()->first);
+
+#ifdef Q_OS_LINUX
+    if (_listener != -1)
+        ::close(_listener);
+    if (_epoll != -1)
+        ::close(_epoll);
+#endif
+}
+
+bool SocketCollector::listen(const QString &address, quint16 port)
+{
+#ifdef Q_OS_LINUX
+    sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length = 0;
+
+    const QByteArray text = address.toLatin1();
+    sockaddr_in& in     = reinterpret_cast<sockaddr_in&>(storage);
+    sockaddr_in6& in6   = reinterpret_cast<sockaddr_in6&>(storage);
+    if (inet_pton(AF_INET, text.constData(), &in.sin_addr) == 1) {
+        in.sin_family   = AF_INET;
+        in.sin_port     = htons(port);
+        length          = sizeof(in);
+    }
+    else if (inet_pton(AF_INET6, text.constData(), &in6.sin6_addr) == 1) {
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port   = htons(port);
+        length          = sizeof(in6);
+    }
+    else {
+        _error = QString("invalid address %1").arg(address);
+        return false;
+    }
+
+    _listener = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listener == -1) {
+        _error = errnoString("socket");
+        return false;
+    }
+
+    const int on = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(_listener, reinterpret_cast<sockaddr*>(&storage), length) == -1
+            || ::listen(_listener, SOMAXCONN) == -1) {
+        _error = errnoString("listen");
+        return false;
+    }
+
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll == -1) {
+        _error = errnoString("epoll_create1");
+        return false;
+    }
+
+    epoll_event event;
+    event.events    = EPOLLIN;
+    event.data.fd   = _listener;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _listener, &event) == -1) {
+        _error = errnoString("epoll_ctl");
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    _error = "epoll is Linux only";
+    return false;
+#endif
+}
+
+qint64 SocketCollector::poll(int msecs)
+{
+#ifdef Q_OS_LINUX
+    if (_epoll == -1)
+        return 0;
+
+    epoll_event events[64];
+    const int ready = epoll_wait(_epoll, events, 64, msecs);
+    qint64 received = 0;
+    for (int i = 0; i < ready; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == _listener) {
+            accept();
+            continue;
+        }
+
+        auto it = _connections.find(fd);
+        if (it == _connections.end())
+            continue;
+
+        const qint64 bytes = receive(*it->second);
+        if (bytes == -1)
+            close(fd);
+        else
+            received += bytes;
+    }
+    return received;
+#else
+    Q_UNUSED(msecs)
+    return 0;
+#endif
+}
+
+void SocketCollector::flush()
+{
+    for (auto& output : _outputs) {
+        write(*output.second);
+        output.second->file.flush();
+    }
+}
+
+void SocketCollector::report(qint64 nsecs)
+{
+    const double seconds = nsecs > 0 ? nsecs / 1e9 : 1.0;
+    for (auto& entry : _connections) {
+        Connection& connection = *entry.second;
+
+        QJsonObject result;
+        result.insert("peer",               connection.peer);
+        result.insert("file",               connection.output->file.fileName());
+        result.insert("bytes",              static_cast<double>(connection.bytes));
+        result.insert("messages",           static_cast<double>(connection.messages));
+        result.insert("bytes_per_sec",      connection.bytes / seconds);
+        result.insert("messages_per_sec",   connection.messages / seconds);
+        result.insert("total_bytes",        static_cast<double>(connection.total_bytes));
+        result.insert("total_messages",     static_cast<double>(connection.total_messages));
+        printJson(result);
+
+        connection.bytes    = 0;
+        connection.messages = 0;
+    }
+}
+
+QString SocketCollector::errorString() const
+{
+    return _error;
+}
+
+void SocketCollector::accept()
+{
+#ifdef Q_OS_LINUX
+    forever {
+        sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        const int fd = accept4(_listener, reinterpret_cast<sockaddr*>(&address), &length,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                _error = errnoString("accept4");
+            return;
+        }
+
+        QString host;
+        const QString peer = peerName(address, &host);
+        const QString name = "tcp-" + QString(_key == SourceKey::Host ? host : peer)
+                .replace(QChar(':'), QChar('-')).remove(QChar('[')).remove(QChar(']'));
+
+        std::unique_ptr<Output>& output = _outputs[name];
+        if (!output) {
+            output.reset(new Output);
+            output->name        = name;
+            output->connections = 0;
+            output->file.setFileName(_directory.filePath(name + ".log"));
+            if (!output->file.open(QIODevice::Append)) {
+                _error = QString("%1: %2").arg(output->file.fileName()).arg(output->file.errorString());
+                _outputs.erase(name);
+                ::close(fd);
+                continue;
+            }
+        }
+
+        std::unique_ptr<Connection> connection(new Connection);
+        connection->fd              = fd;
+        connection->peer            = peer;
+        connection->output          = output.get();
+        connection->bytes           = 0;
+        connection->messages        = 0;
+        connection->total_bytes     = 0;
+        connection->total_messages  = 0;
+        if (_framing == QLoggerSocketStream::Framing::LengthPrefixed)
+            connection->decoder.reset(new QLoggerFrameDecoder);
+        ++output->connections;
+
+        epoll_event event;
+        event.events    = EPOLLIN | EPOLLRDHUP;
+        event.data.fd   = fd;
+        if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+            _error = errnoString("epoll_ctl");
+            _connections[fd] = std::move(connection);
+            close(fd);
+            continue;
+        }
+        _connections[fd] = std::move(connection);
+    }
+#endif
+}
+
+qint64 SocketCollector::receive(Connection &connection)
+{
+#ifdef Q_OS_LINUX
+    char buffer[ReadSize];
+    qint64 received = 0;
+    for (int i = 0; i < ReadsPerTurn; ++i) {
+        const ssize_t bytes = ::read(connection.fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            if (connection.decoder) {
+                if (!decode(connection, buffer, static_cast<int>(bytes))) {
+                    _error = QString("%1: %2").arg(connection.peer).arg(connection.decoder->errorString());
+                    return -1;
+                }
+            }
+            else {
+                consume(connection, buffer, static_cast<int>(bytes));
+            }
+            received += bytes;
+            if (bytes < static_cast<ssize_t>(sizeof(buffer)))
+                return received;    // drained, no need for a read returning EAGAIN
+        }
+        else if (bytes == 0) {
+            return -1;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? received : -1;
+        }
+    }
+    return received;
+#else
+    Q_UNUSED(connection)
+    return -1;
+#endif
+}
+
+void SocketCollector::consume(Connection &connection, const char *data, int size)
+{
+    connection.bytes        += static_cast<quint64>(size);
+    connection.total_bytes  += static_cast<quint64>(size);
+
+    const char* end     = data + size;
+    const quint64 lines = static_cast<quint64>(std::count(data, end, '\n'));
+    if (lines == 0) {
+        connection.partial.append(data, size);
+        return;
+    }
+
+    connection.messages         += lines;
+    connection.total_messages   += lines;
+
+    // up to the last '\n' goes to the file, the rest waits for its end
+    const char* last = data + size - 1;
+    while (*last != '\n')
+        --last;
+
+    Output& output = *connection.output;
+    output.batch.append(connection.partial);
+    output.batch.append(data, static_cast<int>(last + 1 - data));
+    connection.partial = QByteArray(last + 1, static_cast<int>(end - last - 1));
+
+    if (output.batch.size() >= BatchSize)
+        write(output);
+}
+
+bool SocketCollector::decode(Connection &connection, const char *data, int size)
+{
+    connection.bytes        += static_cast<quint64>(size);
+    connection.total_bytes  += static_cast<quint64>(size);
+
+    Output& output = *connection.output;
+    QLoggerFrameDecoder::Frame frame;
+    connection.decoder->append(data, size);
+    while (connection.decoder->next(&frame)) {
+        output.batch.append(frame.message).append('\n');
+        ++connection.messages;
+        ++connection.total_messages;
+    }
+
+    if (output.batch.size() >= BatchSize)
+        write(output);
+    return !connection.decoder->hasError();
+}
+
+void SocketCollector::write(Output &output)
+{
+    if (output.batch.isEmpty())
+        return;
+
+    if (output.file.write(output.batch) == -1)
+        _error = QString("%1: %2").arg(output.file.fileName()).arg(output.file.errorString());
+    output.batch.resize(0);
+}
+
+void SocketCollector::close(int fd)
+{
+    auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    Connection& connection  = *it->second;
+    Output& output          = *connection.output;
+    if (!connection.partial.isEmpty())
+        output.batch.append(connection.partial).append('\n');    // the client died in the middle of a line
+
+    QJsonObject result;
+    result.insert("peer",           connection.peer);
+    result.insert("file",           output.file.fileName());
+    result.insert("closed",         true);
+    result.insert("total_bytes",    static_cast<double>(connection.total_bytes));
+    result.insert("total_messages", static_cast<double>(connection.total_messages));
+    printJson(result);
+
+#ifdef Q_OS_LINUX
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+#endif
+
+    if (--output.connections == 0) {
+        write(output);
+        output.file.close();
+        _outputs.erase(output.name);
+    }
+    _connections.erase(it);
+}
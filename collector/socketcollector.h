@@ -0,0 +1,160 @@
+#ifndef SOCKETCOLLECTOR_H
+#define SOCKETCOLLECTOR_H
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QString>
+
+#include "qlogger.h"
+
+#include <map>
+#include <memory>
+
+/*!
+ *  \class SocketCollector ""
+ *  \brief The SocketCollector class
+ *  It receives the messages of QLoggerSocketStream clients and appends them
+ *  to a file per source, connection or host. A single thread serves all the
+ *  connections with epoll, a connection gets at most ReadsPerTurn reads
+ *  before the others, so a chatty client doesn't hold back the rest.
+ *  Only complete lines reach the files, so clients sharing a file don't mix
+ *  their messages, and they are written BatchSize bytes at a time or when
+ *  the caller flushes. Clients using QLoggerSocketStream::Framing::LengthPrefixed
+ *  are decoded by QLoggerFrameDecoder instead, each message becoming a line.
+ *  Linux only, listen() fails elsewhere.
+ */
+class SocketCollector
+{
+public:
+    static const int BatchSize      = 1 << 16;  //!< bytes buffered per file before writing
+    static const int ReadSize       = 1 << 16;  //!< bytes read per read()
+    static const int ReadsPerTurn   = 4;        //!< reads of a connection before serving the others
+
+    /*!
+     *  \brief The SourceKey enum
+     *  What gets a file of its own
+     */
+    enum class SourceKey {
+        Connection,     //!< every connection, the file is named after the address and the port of the peer
+        Host            //!< every peer address, its connections share the file
+    };
+
+    /*!
+     *  \brief Constructor
+     *  \param directory where the files are written
+     *  \param key what gets a file of its own
+     *  \param framing how the clients send their messages
+     */
+    SocketCollector(const QDir& directory, SourceKey key,
+                    QLoggerSocketStream::Framing framing = QLoggerSocketStream::Framing::Lines);
+
+    /*!
+     *  \brief Destructor, writes what's buffered and closes everything
+     */
+    ~SocketCollector();
+
+    SocketCollector(const SocketCollector&) = delete;
+    SocketCollector& operator=(const SocketCollector&) = delete;
+
+    /*!
+     *  \brief Starts listening
+     *  \param address IPv4 or IPv6 address to listen on
+     *  \param port
+     *  \return true if successful, otherwise false
+     */
+    bool listen(const QString& address, quint16 port);
+
+    /*!
+     *  \brief Waits for connections and data and handles them
+     *  \param msecs how long to wait if nothing is ready, 0 doesn't wait
+     *  \return the bytes received
+     */
+    qint64 poll(int msecs);
+
+    /*!
+     *  \brief Writes the buffered lines in the files and flushes them
+     */
+    void flush();
+
+    /*!
+     *  \brief Prints the throughput of each connection since the last report, one JSON object per line
+     *  \param nsecs time since the last report
+     */
+    void report(qint64 nsecs);
+
+    /*!
+     *  \brief error utility
+     *  \return the last error description
+     */
+    QString errorString() const;
+
+private:
+    /*!
+     *  \brief A file and the lines waiting to be written in it
+     */
+    struct Output {
+        QString     name;           //!< key in _outputs
+        QFile       file;           //!< where the lines go
+        QByteArray  batch;          //!< complete lines not yet written
+        int         connections;    //!< connections writing in it, it's closed at 0
+    };
+
+    /*!
+     *  \brief A client
+     */
+    struct Connection {
+        int         fd;             //!< the socket
+        QString     peer;           //!< address:port of the client
+        Output*     output;         //!< its file
+        QByteArray  partial;        //!< last line received, until its '\n' comes
+        std::unique_ptr<QLoggerFrameDecoder>    decoder;    //!< set if the messages are framed
+        quint64     bytes;          //!< bytes received since the last report
+        quint64     messages;       //!< lines received since the last report
+        quint64     total_bytes;    //!< bytes received since connected
+        quint64     total_messages; //!< lines received since connected
+    };
+
+    /*!
+     *  \brief Accepts the pending connections and opens their files
+     */
+    void accept();
+
+    /*!
+     *  \brief Reads what a connection sent
+     *  \return the bytes received, -1 if the connection is over
+     */
+    qint64 receive(Connection& connection);
+
+    /*!
+     *  \brief Appends the complete lines of data to the file of the connection
+     */
+    void consume(Connection& connection, const char* data, int size);
+
+    /*!
+     *  \brief Appends the complete frames of data to the file of the connection, a line each
+     *  \return false if a frame made no sense
+     */
+    bool decode(Connection& connection, const char* data, int size);
+
+    /*!
+     *  \brief Writes the batch of an output in its file
+     */
+    void write(Output& output);
+
+    /*!
+     *  \brief Closes a connection, and its file if it was the last one using it
+     */
+    void close(int fd);
+
+    QDir                                            _directory;     //!< where the files are written
+    SourceKey                                       _key;           //!< what gets a file
+    QLoggerSocketStream::Framing                    _framing;       //!< how the clients send
+    int                                             _epoll;         //!< epoll instance, -1 if not listening
+    int                                             _listener;      //!< listening socket, -1 if not listening
+    std::map<int, std::unique_ptr<Connection>>      _connections;   //!< clients by socket
+    std::map<QString, std::unique_ptr<Output>>      _outputs;       //!< files by name
+    QString                                         _error;         //!< last error
+};
+
+#endif // SOCKETCOLLECTOR_H
@@ -16,6 +16,10 @@ SOURCES += qlogger.cpp
 HEADERS += qlogger.h\
         qlogger_global.h
 
+unix:!macx {
+    LIBS += -lrt    # shm_open() of QLoggerSharedMemoryStream
+}
+
 unix {
     target.path = /usr/lib
     INSTALLS += target
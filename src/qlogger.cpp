@@ -1,11 +1,58 @@
+#include <QCoreApplication>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QLocale>
 #include <QMutexLocker>
+#include <QtEndian>
 #include <QSslSocket>
+#include <QtAlgorithms>
+#include <QtNumeric>
 
 #include "qlogger.h"
 
 #include <QDebug>
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define QLOGGER_SSE2
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define QLOGGER_AVX2     // compiled for AVX2 whatever the flags, used only if the CPU has it
+#  endif
+#endif
+
+#ifdef Q_OS_UNIX
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <locale.h>
+#  include <netdb.h>
+#  include <signal.h>
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+#ifdef Q_OS_DARWIN
+#  include <xlocale.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#  include <pthread.h>
+#  include <sched.h>
+#  include <sys/resource.h>
+#  include <sys/syscall.h>
+#endif
+
 QLoggerFileStream::QLoggerFileStream(const QString &filename) :
     QLoggerStream(), _file(filename), _flush_rate(4), _flush_count(0) {}
 
@@ -21,7 +68,12 @@ bool QLoggerFileStream::isOpen() const
 
 qint64 QLoggerFileStream::write(const QString &s)
 {
-    qint64 bytes = _file.write(s.toUtf8());
+    return writeData(s.toUtf8());
+}
+
+qint64 QLoggerFileStream::writeData(const QByteArray &data)
+{
+    qint64 bytes = _file.write(data);
 
     if (bytes != -1 && _flush_rate > 0) {
         _flush_count = (_flush_count + 1) % _flush_rate;
@@ -37,6 +89,11 @@ bool QLoggerFileStream::flush()
     return _file.flush();
 }
 
+int QLoggerFileStream::handle() const
+{
+    return _file.handle();
+}
+
 void QLoggerFileStream::close()
 {
     _file.close();
@@ -70,7 +127,8 @@ int QLoggerFileStream::flushRate() const
 
 QLoggerSocketStream::QLoggerSocketStream(socket_ptr socketImpl, const QString &hostname,
                                          quint16 port) :
-    QLoggerStream(), _socket(std::move(socketImpl)), _hostname(hostname), _port(port)
+    QLoggerStream(), _socket(std::move(socketImpl)), _hostname(hostname), _port(port),
+    _framing(Framing::Lines)
 {
 }
 
@@ -94,6 +152,16 @@ quint16 QLoggerSocketStream::port() const
     return _port;
 }
 
+void QLoggerSocketStream::setFraming(Framing framing)
+{
+    _framing = framing;
+}
+
+QLoggerSocketStream::Framing QLoggerSocketStream::framing() const
+{
+    return _framing;
+}
+
 QAbstractSocket *QLoggerSocketStream::socket() const
 {
     return _socket.get();
@@ -119,9 +187,144 @@ bool QLoggerSocketStream::isOpen() const
 
 qint64 QLoggerSocketStream::write(const QString &s)
 {
-    qint64 bytes = _socket->write(s.toUtf8());
+    return writeData(s.toUtf8());
+}
+
+qint64 QLoggerSocketStream::writeData(const QByteArray &data)
+{
+    if (_framing == Framing::LengthPrefixed)
+        return writeMessage(data, static_cast<int>(QLogger::LogLevel::Info),
+                            QDateTime::currentMSecsSinceEpoch(), QString());
+    return send(data);
+}
+
+qint64 QLoggerSocketStream::writeMessage(const QByteArray &data, int level, qint64 timestamp,
+                                         const QString &category)
+{
+    if (_framing == Framing::Lines)
+        return send(data);
+
+    if (category != _category) {
+        _category_utf8  = category.toUtf8();
+        _category       = category;
+    }
+
+    // the frame tells where the message ends, the '\n' is useless
+    const int size = data.endsWith('\n') ? data.size() - 1 : data.size();
+    _frame.resize(0);
+    QLoggerFrameDecoder::encode(&_frame, QByteArray::fromRawData(data.constData(), size), level, timestamp,
+                                _category_utf8);
+    return send(_frame);
+}
+
+qint64 QLoggerSocketStream::send(const QByteArray &bytes)
+{
+    qint64 written = _socket->write(bytes);
     _socket->waitForBytesWritten();
-    return bytes;
+    return written;
+}
+
+QLoggerFrameDecoder::QLoggerFrameDecoder(int maxMessageSize) :
+    _offset(0), _max_message(qBound(0, maxMessageSize, 1 << 30)) {}
+
+void QLoggerFrameDecoder::encode(QByteArray *frame, const QByteArray &message, int level, qint64 timestamp,
+                                 const QByteArray &category)
+{
+    const int category_size = qMin(category.size(), 0xffff);
+
+    uchar header[HeaderSize];
+    qToBigEndian<quint32>(static_cast<quint32>(message.size()), header);
+    header[4] = static_cast<uchar>(Version);
+    header[5] = static_cast<uchar>(level);
+    qToBigEndian<quint16>(static_cast<quint16>(category_size), header + 6);
+    qToBigEndian<qint64>(timestamp, header + 8);
+
+    frame->reserve(frame->size() + HeaderSize + category_size + message.size());
+    frame->append(reinterpret_cast<const char*>(header), HeaderSize);
+    frame->append(category.constData(), category_size);
+    frame->append(message);
+}
+
+void QLoggerFrameDecoder::append(const char *data, int size)
+{
+    // what next() took goes away before the buffer grows
+    if (_offset > 0 && (_offset == _buffer.size() || _offset >= (1 << 16))) {
+        _buffer.remove(0, _offset);
+        _offset = 0;
+    }
+    _buffer.append(data, size);
+}
+
+void QLoggerFrameDecoder::append(const QByteArray &data)
+{
+    append(data.constData(), data.size());
+}
+
+bool QLoggerFrameDecoder::next(Frame *frame)
+{
+    const int available = _buffer.size() - _offset;
+    if (!_error.isEmpty() || available < HeaderSize)
+        return false;
+
+    const uchar* header         = reinterpret_cast<const uchar*>(_buffer.constData()) + _offset;
+    const quint32 size          = qFromBigEndian<quint32>(header);
+    const int version           = header[4];
+    const int level             = header[5];
+    const int category_size     = qFromBigEndian<quint16>(header + 6);
+
+    if (version != Version) {
+        _error = QString("unknown frame version %1").arg(version);
+        return false;
+    }
+    if (level > static_cast<int>(QLogger::LogLevel::Fatal)) {
+        _error = QString("unknown level %1").arg(level);
+        return false;
+    }
+    if (size > static_cast<quint32>(_max_message)) {
+        _error = QString("message of %1 bytes, more than %2").arg(size).arg(_max_message);
+        return false;
+    }
+
+    const int total = HeaderSize + category_size + static_cast<int>(size);
+    if (available < total)
+        return false;
+
+    const char* body    = _buffer.constData() + _offset + HeaderSize;
+    frame->level        = level;
+    frame->timestamp    = qFromBigEndian<qint64>(header + 8);
+    frame->category     = QString::fromUtf8(body, category_size);
+    frame->message      = QByteArray(body + category_size, static_cast<int>(size));
+
+    _offset += total;
+    return true;
+}
+
+int QLoggerFrameDecoder::buffered() const
+{
+    return _buffer.size() - _offset;
+}
+
+bool QLoggerFrameDecoder::hasError() const
+{
+    return !_error.isEmpty();
+}
+
+QString QLoggerFrameDecoder::errorString() const
+{
+    return _error;
+}
+
+void QLoggerFrameDecoder::clear()
+{
+    _buffer.clear();
+    _offset = 0;
+    _error.clear();
+}
+
+bool QLoggerSocketStream::flush()
+{
+    _socket->flush();
+    return _socket->bytesToWrite() == 0 || _socket->waitForBytesWritten();
 }
 
 void QLoggerSocketStream::close()
@@ -134,132 +337,3870 @@ QString QLoggerSocketStream::errorString() const
     return _socket->errorString();
 }
 
-QLogger::QLogger(stream_ptr stream, QObject *parent) :
-    QThread(parent), _stream(std::move(stream))
+#ifdef Q_OS_UNIX
+namespace {
+
+#ifdef MSG_NOSIGNAL
+const int send_flags = MSG_NOSIGNAL;    // a gone receiver is an error, not a SIGPIPE
+#else
+const int send_flags = 0;               // SO_NOSIGPIPE is set instead
+#endif
+
+QString errnoString(const char* function)
 {
-    _finish.store(0);
-    _messages_size.store(0);
+    return QString("%1: %2").arg(function).arg(QString::fromLocal8Bit(strerror(errno)));
+}
 
-    _error_string   = "";
-    _format_string  = "[%1] %2 %3";
-    _datetime_format= "dd.MM.yyyy hh:mm:ss";
 }
+#endif
 
-QLogger::~QLogger()
+QLoggerUnixSocketStream::QLoggerUnixSocketStream(const QString &path, Mode mode) :
+    QLoggerStream(), _path(path), _mode(mode), _fd(-1) {}
+
+QLoggerUnixSocketStream::~QLoggerUnixSocketStream()
+{
+    close();
+}
+
+bool QLoggerUnixSocketStream::open()
 {
-    if (_stream->isOpen())
-        _stream->close();   // RAII
+#ifdef Q_OS_UNIX
+    if (_fd != -1)
+        return true;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    const QByteArray path = QFile::encodeName(_path);
+    if (path.isEmpty() || static_cast<std::size_t>(path.size()) >= sizeof(address.sun_path)) {
+        _error = QString("invalid socket path %1").arg(_path);
+        return false;
+    }
+
+    memcpy(address.sun_path, path.constData(), static_cast<std::size_t>(path.size()));
+    socklen_t length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+#ifdef Q_OS_LINUX
+    if (path.startsWith('@')) {
+        address.sun_path[0] = '\0';     // abstract namespace, the name isn't nul terminated
+        length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+    }
+#endif
+
+    const int fd = socket(AF_UNIX, _mode == Mode::SeqPacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+    if (fd == -1) {
+        _error = errnoString("socket");
+        return false;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), length) == -1) {
+        _error = errnoString("connect");
+        ::close(fd);
+        return false;
+    }
+
+    _fd = fd;
+    _error.clear();
+    return true;
+#else
+    _error = "unix sockets aren't supported on this platform";
+    return false;
+#endif
 }
 
-QLogger::stream_ptr& QLogger::stream()
+bool QLoggerUnixSocketStream::isOpen() const
 {
-    return _stream;
+    return _fd != -1;
 }
 
-void QLogger::addMessage(const QString &message, const LogLevel &level)
+qint64 QLoggerUnixSocketStream::write(const QString &s)
 {
-    qDebug() << "QLogger::addMessage()";
+    return writeData(s.toUtf8());
+}
 
-    _empty.wakeOne();
-    {
-        QMutexLocker locker(&_mutex);
-        const QString levelString = logLevelToString(level);
+qint64 QLoggerUnixSocketStream::writeData(const QByteArray &data)
+{
+#ifdef Q_OS_UNIX
+    if (_fd == -1)
+        return -1;
 
-        const QString datetime = QDateTime::currentDateTime().toString(_datetime_format);
+    // a packet goes whole or not at all, a stream may take several calls
+    const char* next    = data.constData();
+    std::size_t left    = static_cast<std::size_t>(data.size());
+    do {
+        // retried here: a continue would leave the loop in SeqPacket mode with the packet unsent
+        ssize_t sent = ::send(_fd, next, left, send_flags);
+        while (sent == -1 && errno == EINTR)
+            sent = ::send(_fd, next, left, send_flags);
 
-        _messages.append(_format_string.arg(datetime).arg(levelString).arg(message) + "\n");
-        _messages_size.store(_messages.size());
-    }
-    qDebug() << "QLogger::addMessage----->Wake one";
+        if (sent == -1) {
+            _error = errno == EMSGSIZE ? QString("message longer than the socket send buffer")
+                                       : errnoString("send");
+            return -1;
+        }
+
+        next += sent;
+        left -= static_cast<std::size_t>(sent);
+    } while (left > 0 && _mode == Mode::Stream);
+
+    return data.size();
+#else
+    Q_UNUSED(data)
+    return -1;
+#endif
 }
 
-void QLogger::run()
+int QLoggerUnixSocketStream::handle() const
 {
-    if (!_stream->open()) {
-        _error_string = _stream->errorString();
-        _stream->close();
+    return _fd;
+}
+
+void QLoggerUnixSocketStream::close()
+{
+#ifdef Q_OS_UNIX
+    if (_fd == -1)
         return;
+
+    ::close(_fd);
+    _fd = -1;
+#endif
+}
+
+QString QLoggerUnixSocketStream::errorString() const
+{
+    return _error;
+}
+
+void QLoggerUnixSocketStream::setPath(const QString &path)
+{
+    _path = path;
+}
+
+QString QLoggerUnixSocketStream::path() const
+{
+    return _path;
+}
+
+QLoggerUnixSocketStream::Mode QLoggerUnixSocketStream::mode() const
+{
+    return _mode;
+}
+
+namespace {
+
+/*!
+ *  \brief Makes a RFC 5424 header field of a value
+ *  \param value
+ *  \param max bytes of the field
+ *  \return value with what isn't printable ASCII replaced by '_', "-" if empty
+ */
+QByteArray syslogField(const QByteArray& value, int max)
+{
+    if (value.isEmpty())
+        return QByteArray("-");
+
+    QByteArray field = value.left(max);
+    for (int i = 0; i < field.size(); ++i) {
+        const uchar c = static_cast<uchar>(field.at(i));
+        if (c < 33 || c > 126)
+            field[i] = '_';
     }
+    return field;
+}
 
-    while ( !_finish.load() || _messages_size.load() != 0) {
-        if (_messages_size.load() != 0) {
-            qDebug() << "QLogger::run()----->Mutex lock";
-            _mutex.lock();
-            const QString message = _messages.front();
-            _messages.pop_front();
-            _messages_size.store(_messages.size());
+}
 
-            _mutex.unlock();
+QLoggerSyslogStream::QLoggerSyslogStream(const QString &host, quint16 port, Facility facility) :
+    QLoggerStream(), _host(host), _port(port), _facility(facility), _max_datagram(2048), _fd(-1),
+    _second(-1), _msgid("-"), _failed(false), _truncated(0)
+{
+    _ends.reserve(BatchSize);
+    buildPrefixes();
+}
+
+QLoggerSyslogStream::~QLoggerSyslogStream()
+{
+    close();
+}
 
-            qDebug() << "QLogger::run()----->Mutex unlock";
+bool QLoggerSyslogStream::open()
+{
+#ifdef Q_OS_UNIX
+    if (_fd != -1)
+        return true;
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_DGRAM;
+
+    addrinfo* addresses = nullptr;
+    const int resolved  = getaddrinfo(_host.toUtf8().constData(), QByteArray::number(_port).constData(),
+                                      &hints, &addresses);
+    if (resolved != 0) {
+        _error = QString("%1: %2").arg(_host).arg(QString::fromLocal8Bit(gai_strerror(resolved)));
+        return false;
+    }
 
-            qDebug() << "QLogger::run()----->Stream writing";
-            _stream->write(message);
+    int fd = -1;
+    for (addrinfo* address = addresses; address != nullptr && fd == -1; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd == -1) {
+            _error = errnoString("socket");
+            continue;
         }
-        else if (!_finish.load()){
-            qDebug() << "QLogger::run()----->Must wait";
-            _mutex.lock();
-            _empty.wait(&_mutex);
-            _mutex.unlock();
+
+        // connected, the datagrams need no address
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) == -1) {
+            _error = errnoString("connect");
+            ::close(fd);
+            fd = -1;
         }
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1)
+        return false;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    char hostname[256] = "";
+    gethostname(hostname, sizeof(hostname) - 1);
+    const QString app = _app_name.isEmpty() ? QCoreApplication::applicationName() : _app_name;
+
+    _fields.clear();
+    _fields.append(' ').append(syslogField(QByteArray(hostname), 255));
+    _fields.append(' ').append(syslogField(app.toUtf8(), 48));
+    _fields.append(' ').append(QByteArray::number(static_cast<qint64>(getpid()))).append(' ');
 
+    _fd     = fd;
+    _failed = false;
+    _error.clear();
+    return true;
+#else
+    _error = "syslog over UDP isn't supported on this platform";
+    return false;
+#endif
+}
+
+bool QLoggerSyslogStream::isOpen() const
+{
+    return _fd != -1;
+}
+
+qint64 QLoggerSyslogStream::write(const QString &s)
+{
+    return writeData(s.toUtf8());
+}
+
+qint64 QLoggerSyslogStream::writeData(const QByteArray &data)
+{
+    return writeMessage(data, static_cast<int>(QLogger::LogLevel::Info), QDateTime::currentMSecsSinceEpoch(),
+                        QString());
+}
+
+qint64 QLoggerSyslogStream::writeMessage(const QByteArray &data, int level, qint64 timestamp,
+                                         const QString &category)
+{
+    if (_fd == -1)
+        return -1;
+
+    // the header only changes with the second and the category
+    timestamp = qMax<qint64>(timestamp, 0);
+    const qint64 second = timestamp / 1000;
+    if (second != _second) {
+        _time   = QDateTime::fromMSecsSinceEpoch(second * 1000, Qt::UTC)
+                .toString("yyyy-MM-dd'T'hh:mm:ss").toLatin1();
+        _second = second;
     }
-    _stream->close();
-    qDebug() << "QLogger::run()----->End run";
+    if (category != _category) {
+        _msgid      = syslogField(category.toUtf8(), 32);
+        _category   = category;
+    }
+
+    const int msecs = static_cast<int>(timestamp % 1000);
+    const char fraction[] = { '.', static_cast<char>('0' + msecs / 100), static_cast<char>('0' + msecs / 10 % 10),
+                              static_cast<char>('0' + msecs % 10), 'Z' };
+
+    const int start = _batch.size();
+    _batch.append(_prefixes[severity(level)]).append(_time).append(fraction, sizeof(fraction));
+    _batch.append(_fields).append(_msgid).append(" - ");
+
+    int size = data.size();
+    if (size > 0 && data.at(size - 1) == '\n')
+        --size;
+
+    const int room = _max_datagram - (_batch.size() - start);
+    if (size > room) {
+        size = qMax(room, 0);
+        while (size > 0 && (static_cast<uchar>(data.at(size)) & 0xC0) == 0x80)
+            --size;     // not in the middle of a character
+        ++_truncated;
+    }
+    _batch.append(data.constData(), size);
+    _ends.push_back(_batch.size());
+
+    const qint64 bytes = _batch.size() - start;
+
+    bool ok = !_failed;
+    _failed = false;
+    if (static_cast<int>(_ends.size()) >= BatchSize)
+        ok = send() && ok;
+    return ok ? bytes : -1;
 }
 
-void QLogger::finishWriting()
+void QLoggerSyslogStream::drained()
 {
-    _empty.wakeOne();       // it could be waiting
-    QMutexLocker locker(&_mutex);
-    _finish = 1;
-    qDebug() << "QLogger::finishWriting()----->Wake one";
+    if (!_ends.empty() && !send())
+        _failed = true;
 }
 
-QString QLogger::logLevelToString(const LogLevel &level) const
+bool QLoggerSyslogStream::flush()
 {
-    switch (level) {
-    case LogLevel::Info:        return "INFO";
-    case LogLevel::Debug:       return "DEBUG";
-    case LogLevel::Warning:     return "WARNING";
-    case LogLevel::Fatal:       return "FATAL";
+    bool ok = !_failed;
+    _failed = false;
+    if (!_ends.empty())
+        ok = send() && ok;
+    return ok;
+}
+
+void QLoggerSyslogStream::close()
+{
+#ifdef Q_OS_UNIX
+    if (_fd == -1)
+        return;
+
+    if (!_ends.empty())
+        send();
+    ::close(_fd);
+    _fd = -1;
+#endif
+}
+
+QString QLoggerSyslogStream::errorString() const
+{
+    return _error;
+}
+
+void QLoggerSyslogStream::setHost(const QString &host, quint16 port)
+{
+    _host = host;
+    _port = port;
+}
+
+QString QLoggerSyslogStream::host() const
+{
+    return _host;
+}
+
+quint16 QLoggerSyslogStream::port() const
+{
+    return _port;
+}
+
+void QLoggerSyslogStream::setFacility(Facility facility)
+{
+    _facility = facility;
+    buildPrefixes();
+}
+
+QLoggerSyslogStream::Facility QLoggerSyslogStream::facility() const
+{
+    return _facility;
+}
+
+void QLoggerSyslogStream::setAppName(const QString &name)
+{
+    _app_name = name;
+}
+
+QString QLoggerSyslogStream::appName() const
+{
+    return _app_name;
+}
+
+void QLoggerSyslogStream::setMaxDatagramSize(int bytes)
+{
+    _max_datagram = qBound(480, bytes, 65507);
+}
+
+int QLoggerSyslogStream::maxDatagramSize() const
+{
+    return _max_datagram;
+}
+
+quint64 QLoggerSyslogStream::truncated() const
+{
+    return _truncated;
+}
+
+int QLoggerSyslogStream::severity(int level)
+{
+    switch (static_cast<QLogger::LogLevel>(level)) {
+    case QLogger::LogLevel::Fatal:      return 2;
+    case QLogger::LogLevel::Warning:    return 4;
+    case QLogger::LogLevel::Debug:      return 7;
+    case QLogger::LogLevel::Info:
+    default:                            return 6;
     }
+}
 
-    return "";
+void QLoggerSyslogStream::buildPrefixes()
+{
+    for (int i = 0; i < 8; ++i)
+        _prefixes[i] = QByteArray("<").append(QByteArray::number(static_cast<int>(_facility) * 8 + i)).append(">1 ");
 }
 
-QStringList QLogger::messages() const
+bool QLoggerSyslogStream::send()
+{
+    const int count = static_cast<int>(_ends.size());
+    int failed      = 0;
+
+#if defined(Q_OS_LINUX)
+    iovec vectors[BatchSize];
+    mmsghdr messages[BatchSize];
+    memset(messages, 0, sizeof(messages));
+
+    int start = 0;
+    for (int i = 0; i < count; ++i) {
+        vectors[i].iov_base = _batch.data() + start;
+        vectors[i].iov_len  = static_cast<std::size_t>(_ends[i] - start);
+        messages[i].msg_hdr.msg_iov     = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen  = 1;
+        start = _ends[i];
+    }
+
+    int next = 0;
+    while (next < count) {
+        const int sent = sendmmsg(_fd, messages + next, static_cast<unsigned int>(count - next), send_flags);
+        if (sent > 0) {
+            next += sent;
+        }
+        else if (sent == 0 || errno != EINTR) {
+            _error = sent == 0 ? QString("sendmmsg: no datagram sent") : errnoString("sendmmsg");
+            ++failed;
+            ++next;     // this one is lost, the others may still go
+        }
+    }
+#elif defined(Q_OS_UNIX)
+    int start = 0;
+    for (int i = 0; i < count; ++i) {
+        ssize_t sent;
+        do {
+            sent = ::send(_fd, _batch.constData() + start, static_cast<std::size_t>(_ends[i] - start), send_flags);
+        } while (sent == -1 && errno == EINTR);
+
+        if (sent == -1) {
+            _error = errnoString("send");
+            ++failed;
+        }
+        start = _ends[i];
+    }
+#else
+    failed = count;
+#endif
+
+    _batch.resize(0);
+    _ends.clear();
+    return failed == 0;
+}
+
+QLoggerMemoryStream::QLoggerMemoryStream(int capacity) :
+    QLoggerStream(), _open(false)
+{
+    _data.reserve(capacity);
+}
+
+bool QLoggerMemoryStream::open()
 {
     QMutexLocker locker(&_mutex);
-    return _messages;
+    _open = true;
+    return true;
 }
 
-QString QLogger::errorString() const
+bool QLoggerMemoryStream::isOpen() const
 {
     QMutexLocker locker(&_mutex);
-    return _error_string;
+    return _open;
 }
 
-QString QLogger::formatString() const
+qint64 QLoggerMemoryStream::write(const QString &s)
+{
+    return writeData(s.toUtf8());
+}
+
+qint64 QLoggerMemoryStream::writeData(const QByteArray &data)
 {
     QMutexLocker locker(&_mutex);
-    return _format_string;
+    _data.append(data);
+    return data.size();
 }
 
-QString QLogger::datetimeFormat() const
+void QLoggerMemoryStream::close()
 {
     QMutexLocker locker(&_mutex);
-    return _datetime_format;
+    _open = false;
 }
 
-void QLogger::setFormatString(const QString &formatString)
+QString QLoggerMemoryStream::errorString() const
+{
+    return "";
+}
+
+QByteArray QLoggerMemoryStream::data() const
 {
     QMutexLocker locker(&_mutex);
-    _format_string = formatString;
+    return QByteArray(_data.constData(), _data.size());     // deep copy, _data keeps its capacity
 }
 
-void QLogger::setDatetimeFormat(const QString &datetimeFormat)
+void QLoggerMemoryStream::clear()
 {
     QMutexLocker locker(&_mutex);
-    _datetime_format = datetimeFormat;
+    _data.resize(0);
+}
+
+namespace {
+
+const quint32 shared_ring_magic     = 0x52534c51;   // "QLSR"
+const quint32 shared_ring_version   = 1;
+const quint32 shared_ring_wrap      = 0xffffffff;   //!< length of the marker sending the reader back to the start
+
+/*!
+ *  \brief Header of a QLoggerSharedMemoryStream segment, the ring follows it
+ *  Each message is its length on 32 bits and its bytes, padded to 8 bytes.
+ *  head and tail only grow, their offset in the ring is modulo the capacity.
+ */
+struct SharedRingHeader {
+    std::atomic<quint32>    magic;      //!< shared_ring_magic once initialized
+    quint32                 version;    //!< shared_ring_version
+    quint64                 capacity;   //!< bytes of the ring, a power of 2
+    std::atomic<qint64>     producer;   //!< pid of the writing process, 0 if none
+    std::atomic<quint64>    dropped;    //!< messages not written because the ring was full
+    alignas(64) std::atomic<quint64> head;  //!< end of the published messages, written by the stream
+    alignas(64) std::atomic<quint64> tail;  //!< end of the read messages, written by the reader
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the shared ring needs address-free 64 bit atomics");
+
+inline SharedRingHeader* sharedRingHeader(void* mapping)
+{
+    return static_cast<SharedRingHeader*>(mapping);
+}
+
+inline char* sharedRingData(void* mapping)
+{
+    return static_cast<char*>(mapping) + sizeof(SharedRingHeader);
+}
+
+inline quint64 sharedRingRecord(quint64 length)
+{
+    return (sizeof(quint32) + length + 7) & ~quint64(7);
+}
+
+QString sharedMemoryName(const QString& name)
+{
+    return name.startsWith(QChar('/')) ? name : "/" + name;
+}
+
+#ifdef Q_OS_UNIX
+bool isProcessAlive(qint64 pid)
+{
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+/*!
+ *  \brief Checks if the process pid can take a segment
+ *  \param producer the producer of the segment: 0 if none, minus the pid of a reader removing it
+ *  \return true if it has no live owner but pid
+ */
+bool isSegmentFree(qint64 producer, qint64 pid)
+{
+    return producer == 0 || producer == pid || !isProcessAlive(producer < 0 ? -producer : producer);
+}
+#endif
+
+}
+
+QLoggerSharedMemoryStream::QLoggerSharedMemoryStream(const QString &name, int capacity) :
+    QLoggerStream(), _name(sharedMemoryName(name)), _capacity(4096), _mapping(nullptr), _head(0)
+{
+    while (_capacity < static_cast<quint64>(qMax(capacity, 0)))
+        _capacity <<= 1;
+}
+
+QLoggerSharedMemoryStream::~QLoggerSharedMemoryStream()
+{
+    close();
+}
+
+bool QLoggerSharedMemoryStream::open()
+{
+#ifdef Q_OS_UNIX
+    if (_mapping)
+        return true;
+
+    // a reader removing the segment unlinks it right after claiming it, the name then leads to a new one
+    for (int attempt = 0; attempt < RemoveRetries; ++attempt) {
+        bool removing = false;
+        if (attach(&removing))
+            return true;
+        if (!removing)
+            return false;
+        usleep(1000);
+    }
+    return false;
+#else
+    _error = "shared memory isn't supported on this platform";
+    return false;
+#endif
+}
+
+bool QLoggerSharedMemoryStream::attach(bool *removing)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray name = _name.toLocal8Bit();
+    const int fd = shm_open(name.constData(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        _error = errnoString("shm_open");
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        _error = errnoString("fstat");
+        ::close(fd);
+        return false;
+    }
+
+    const qint64 pid    = getpid();
+    const auto refuse   = [&](qint64 producer) {
+        *removing   = producer < 0;
+        _error      = producer < 0 ? QString("%1 is being removed by process %2").arg(_name).arg(-producer)
+                                   : QString("%1 is written by process %2").arg(_name).arg(producer);
+    };
+
+    // the owner is checked before the segment is resized or reset under it
+    if (static_cast<quint64>(status.st_size) >= sizeof(SharedRingHeader)) {
+        void* existing = mmap(nullptr, sizeof(SharedRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (existing != MAP_FAILED) {
+            const SharedRingHeader* header = sharedRingHeader(existing);
+            const qint64 producer = header->magic.load(std::memory_order_acquire) == shared_ring_magic
+                    ? header->producer.load() : 0;
+            munmap(existing, sizeof(SharedRingHeader));
+            if (!isSegmentFree(producer, pid)) {
+                refuse(producer);
+                ::close(fd);
+                return false;
+            }
+        }
+    }
+
+    const quint64 size = sizeof(SharedRingHeader) + _capacity;
+    if (static_cast<quint64>(status.st_size) != size && ftruncate(fd, static_cast<off_t>(size)) == -1) {
+        _error = errnoString("ftruncate");
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);    // the mapping keeps the segment
+    if (mapping == MAP_FAILED) {
+        _error = errnoString("mmap");
+        return false;
+    }
+
+    SharedRingHeader* header = sharedRingHeader(mapping);
+    const bool initialized  = header->magic.load(std::memory_order_acquire) == shared_ring_magic
+            && header->version == shared_ring_version;
+    const bool reuse        = initialized && header->capacity == _capacity;
+
+    // claimed before anything is reset, a reader or another stream may have come since the check
+    if (initialized) {
+        qint64 producer = header->producer.load();
+        if (!isSegmentFree(producer, pid) || !header->producer.compare_exchange_strong(producer, pid)) {
+            refuse(producer);
+            munmap(mapping, size);
+            return false;
+        }
+    }
+
+    if (!reuse) {
+        header->magic.store(0);
+        header->version     = shared_ring_version;
+        header->capacity    = _capacity;
+        header->dropped.store(0);
+        header->head.store(0);
+        header->tail.store(0);
+        header->producer.store(pid);
+        header->magic.store(shared_ring_magic, std::memory_order_release);
+    }
+
+    _head       = header->head.load();
+    _mapping    = mapping;
+    _error.clear();
+    return true;
+#else
+    Q_UNUSED(removing)
+    return false;
+#endif
+}
+
+bool QLoggerSharedMemoryStream::isOpen() const
+{
+    return _mapping != nullptr;
+}
+
+qint64 QLoggerSharedMemoryStream::write(const QString &s)
+{
+    return writeData(s.toUtf8());
+}
+
+qint64 QLoggerSharedMemoryStream::writeData(const QByteArray &data)
+{
+    if (!_mapping)
+        return -1;
+
+    SharedRingHeader* header    = sharedRingHeader(_mapping);
+    const quint64 record        = sharedRingRecord(static_cast<quint64>(data.size()));
+    if (record > _capacity / 2) {
+        _error = "message longer than half the ring";
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    // a message doesn't wrap: if it doesn't fit before the end the rest is skipped
+    quint64 offset          = _head & (_capacity - 1);
+    const quint64 to_end    = _capacity - offset;
+    const quint64 needed    = to_end < record ? to_end + record : record;
+    if (_head + needed - header->tail.load(std::memory_order_acquire) > _capacity) {
+        _error = "ring full";
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    char* ring = sharedRingData(_mapping);
+    if (to_end < record) {
+        memcpy(ring + offset, &shared_ring_wrap, sizeof(quint32));
+        _head   += to_end;
+        offset  = 0;
+    }
+
+    const quint32 length = static_cast<quint32>(data.size());
+    memcpy(ring + offset, &length, sizeof(length));
+    memcpy(ring + offset + sizeof(length), data.constData(), length);
+    _head += record;
+    header->head.store(_head, std::memory_order_release);
+    return data.size();
+}
+
+void QLoggerSharedMemoryStream::close()
+{
+#ifdef Q_OS_UNIX
+    if (!_mapping)
+        return;
+
+    sharedRingHeader(_mapping)->producer.store(0, std::memory_order_release);
+    munmap(_mapping, sizeof(SharedRingHeader) + _capacity);
+    _mapping = nullptr;
+#endif
+}
+
+QString QLoggerSharedMemoryStream::errorString() const
+{
+    return _error;
+}
+
+QString QLoggerSharedMemoryStream::name() const
+{
+    return _name;
+}
+
+int QLoggerSharedMemoryStream::capacity() const
+{
+    return static_cast<int>(_capacity);
+}
+
+QLoggerSharedMemoryReader::QLoggerSharedMemoryReader(const QString &name) :
+    _name(sharedMemoryName(name)), _mapping(nullptr), _size(0), _device(0), _inode(0) {}
+
+QLoggerSharedMemoryReader::~QLoggerSharedMemoryReader()
+{
+    close();
+}
+
+bool QLoggerSharedMemoryReader::open()
+{
+#ifdef Q_OS_UNIX
+    if (_mapping)
+        return true;
+
+    const QByteArray name = _name.toLocal8Bit();
+    const int fd = shm_open(name.constData(), O_RDWR, 0);
+    if (fd == -1) {
+        _error = errnoString("shm_open");
+        return false;
+    }
+
+    struct stat status;
+    const bool sized = fstat(fd, &status) == 0
+            && static_cast<quint64>(status.st_size) > sizeof(SharedRingHeader);
+    void* mapping = sized ? mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        _error = "segment not initialized";
+        return false;
+    }
+
+    const quint64 size = static_cast<quint64>(status.st_size);
+    SharedRingHeader* header = sharedRingHeader(mapping);
+    if (header->magic.load(std::memory_order_acquire) != shared_ring_magic
+            || header->version != shared_ring_version
+            || sizeof(SharedRingHeader) + header->capacity != size) {
+        _error = "segment not initialized";
+        munmap(mapping, size);
+        return false;
+    }
+
+    _mapping    = mapping;
+    _size       = size;
+    _device     = static_cast<quint64>(status.st_dev);
+    _inode      = static_cast<quint64>(status.st_ino);
+    _error.clear();
+    return true;
+#else
+    _error = "shared memory isn't supported on this platform";
+    return false;
+#endif
+}
+
+bool QLoggerSharedMemoryReader::isOpen() const
+{
+    return _mapping != nullptr;
+}
+
+void QLoggerSharedMemoryReader::close()
+{
+#ifdef Q_OS_UNIX
+    if (!_mapping)
+        return;
+
+    munmap(_mapping, _size);
+    _mapping    = nullptr;
+    _size       = 0;
+#endif
+}
+
+int QLoggerSharedMemoryReader::read(QByteArray &out, int maxBytes)
+{
+    if (!_mapping)
+        return 0;
+
+    SharedRingHeader* header    = sharedRingHeader(_mapping);
+    const char* ring            = sharedRingData(_mapping);
+    const quint64 capacity      = _size - sizeof(SharedRingHeader);    // not the header, a stream may reset it
+    if (header->magic.load(std::memory_order_acquire) != shared_ring_magic
+            || header->version != shared_ring_version || header->capacity != capacity) {
+        close();
+        _error = open() ? "segment reset by its stream, mapped again" : "segment reset by its stream";
+        return 0;
+    }
+
+    const quint64 head          = header->head.load(std::memory_order_acquire);
+    quint64 tail                = header->tail.load(std::memory_order_relaxed);
+
+    int messages = 0;
+    while (tail != head) {
+        const quint64 offset = tail & (capacity - 1);
+        quint32 length;
+        memcpy(&length, ring + offset, sizeof(length));
+        if (length == shared_ring_wrap) {
+            tail += capacity - offset;
+            continue;
+        }
+
+        const quint64 record = sharedRingRecord(length);
+        if (record > capacity / 2 || record > head - tail) {
+            _error  = "corrupted ring, skipped to its head";
+            tail    = head;
+            break;
+        }
+
+        if (messages > 0 && out.size() + static_cast<qint64>(length) > maxBytes)
+            break;
+
+        out.append(ring + offset + sizeof(length), static_cast<int>(length));
+        tail += record;
+        ++messages;
+    }
+
+    // the room is given back only once copied
+    header->tail.store(tail, std::memory_order_release);
+    return messages;
+}
+
+bool QLoggerSharedMemoryReader::isEmpty() const
+{
+    if (!_mapping)
+        return true;
+
+    const SharedRingHeader* header = sharedRingHeader(_mapping);
+    return header->head.load(std::memory_order_acquire) == header->tail.load(std::memory_order_relaxed);
+}
+
+quint64 QLoggerSharedMemoryReader::dropped() const
+{
+    return _mapping ? sharedRingHeader(_mapping)->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+bool QLoggerSharedMemoryReader::isAbandoned() const
+{
+#ifdef Q_OS_UNIX
+    if (!_mapping)
+        return true;
+
+    const qint64 producer = sharedRingHeader(_mapping)->producer.load(std::memory_order_acquire);
+    return producer <= 0 || !isProcessAlive(producer);
+#else
+    return true;
+#endif
+}
+
+bool QLoggerSharedMemoryReader::remove()
+{
+#ifdef Q_OS_UNIX
+    if (!_mapping) {
+        _error = "segment not open";
+        return false;
+    }
+
+    // claimed first: a stream opening it now waits for the removal instead of writing into a removed segment
+    SharedRingHeader* header    = sharedRingHeader(_mapping);
+    const qint64 removing       = -static_cast<qint64>(getpid());
+    qint64 producer             = header->producer.load(std::memory_order_acquire);
+    if ((producer > 0 && isProcessAlive(producer))
+            || !header->producer.compare_exchange_strong(producer, removing)) {
+        _error = "segment taken over by a stream";
+        return false;
+    }
+
+    // the name may lead to another segment already, e.g. removed and created again
+    const QByteArray name = _name.toLocal8Bit();
+    const int fd = shm_open(name.constData(), O_RDONLY, 0);
+    struct stat status;
+    const bool same = fd != -1 && fstat(fd, &status) == 0
+            && static_cast<quint64>(status.st_dev) == _device && static_cast<quint64>(status.st_ino) == _inode;
+    if (fd != -1)
+        ::close(fd);
+
+    if (!same) {
+        _error = "segment replaced";
+        return false;
+    }
+
+    if (shm_unlink(name.constData()) == -1) {
+        _error = errnoString("shm_unlink");
+        qint64 claimed = removing;
+        header->producer.compare_exchange_strong(claimed, producer);  // given back as it was
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+QString QLoggerSharedMemoryReader::name() const
+{
+    return _name;
+}
+
+QString QLoggerSharedMemoryReader::errorString() const
+{
+    return _error;
+}
+
+namespace {
+
+/*!
+ *  \brief Checks if a byte must be escaped in a JSON string
+ */
+inline bool needsEscape(char c)
+{
+    return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+}
+
+#ifdef QLOGGER_SSE2
+/*!
+ *  \brief Returns the mask of the bytes of chunk needing an escape, bit i for byte i
+ */
+inline int escapeMask(__m128i chunk)
+{
+    // unsigned chunk <= 0x1f, SSE2 has only signed comparisons
+    const __m128i control   = _mm_cmpeq_epi8(_mm_max_epu8(chunk, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    const __m128i quote     = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'));
+    const __m128i backslash = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'));
+    return _mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, backslash)));
+}
+
+/*!
+ *  \brief findEscape() 16 bytes at a time
+ *  \return the index of the first byte needing an escape, or of the tail shorter than 16 bytes
+ */
+int findEscapeSse2(const char* data, int size)
+{
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const int mask = escapeMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+        if (mask != 0)
+            return i + qCountTrailingZeroBits(static_cast<quint32>(mask));
+    }
+    return i;
+}
+#endif
+
+#ifdef QLOGGER_AVX2
+/*!
+ *  \brief findEscape() 32 bytes at a time
+ *  \return the index of the first byte needing an escape, or of the tail shorter than 32 bytes
+ */
+__attribute__((target("avx2")))
+int findEscapeAvx2(const char* data, int size)
+{
+    const __m256i limit         = _mm256_set1_epi8(0x1f);
+    const __m256i quote         = _mm256_set1_epi8('"');
+    const __m256i backslash     = _mm256_set1_epi8('\\');
+
+    int i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, limit), limit),
+                                              _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                                              _mm256_cmpeq_epi8(chunk, backslash)));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(found));
+        if (mask != 0)
+            return i + qCountTrailingZeroBits(mask);
+    }
+    return i;
+}
+
+bool cpuHasAvx2()
+{
+    __builtin_cpu_init();   // the library may be loaded before the compiler runtime initialized it
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool has_avx2 = cpuHasAvx2();     //!< checked once, when the library is loaded
+#endif
+
+}
+
+int QLoggerJson::findEscape(const char *data, int size)
+{
+    int i = 0;
+#if defined(QLOGGER_AVX2)
+    i = has_avx2 ? findEscapeAvx2(data, size) : findEscapeSse2(data, size);
+#elif defined(QLOGGER_SSE2)
+    i = findEscapeSse2(data, size);
+#endif
+
+    for (; i < size; ++i) {
+        if (needsEscape(data[i]))
+            return i;
+    }
+    return size;
+}
+
+void QLoggerJson::appendString(QByteArray &out, const char *data, int size)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    while (size > 0) {
+        const int clean = findEscape(data, size);
+        out.append(data, clean);
+        if (clean == size)
+            break;
+
+        const char c = data[clean];
+        switch (c) {
+        case '"':   out += "\\\"";  break;
+        case '\\':  out += "\\\\";  break;
+        case '\n':  out += "\\n";   break;
+        case '\r':  out += "\\r";   break;
+        case '\t':  out += "\\t";   break;
+        default:
+            out += "\\u00";
+            out += hex[static_cast<unsigned char>(c) >> 4];
+            out += hex[c & 0xf];
+        }
+
+        data += clean + 1;
+        size -= clean + 1;
+    }
+    out += '"';
+}
+
+void QLoggerJson::appendString(QByteArray &out, const QString &s)
+{
+    const QByteArray utf8 = s.toUtf8();
+    appendString(out, utf8.constData(), utf8.size());
+}
+
+QLoggerField::QLoggerField(const QString &key, bool value) :
+    _key(key), _type(Type::Bool)    { _value.b = value; }
+
+QLoggerField::QLoggerField(const QString &key, int value) :
+    _key(key), _type(Type::Int)     { _value.i = value; }
+
+QLoggerField::QLoggerField(const QString &key, long value) :
+    _key(key), _type(Type::Int)     { _value.i = value; }
+
+QLoggerField::QLoggerField(const QString &key, qint64 value) :
+    _key(key), _type(Type::Int)     { _value.i = value; }
+
+QLoggerField::QLoggerField(const QString &key, uint value) :
+    _key(key), _type(Type::UInt)    { _value.u = value; }
+
+QLoggerField::QLoggerField(const QString &key, unsigned long value) :
+    _key(key), _type(Type::UInt)    { _value.u = value; }
+
+QLoggerField::QLoggerField(const QString &key, quint64 value) :
+    _key(key), _type(Type::UInt)    { _value.u = value; }
+
+QLoggerField::QLoggerField(const QString &key, double value) :
+    _key(key), _type(Type::Double)  { _value.d = value; }
+
+QLoggerField::QLoggerField(const QString &key, const QString &value) :
+    _key(key), _type(Type::String), _string(value) { _value.u = 0; }
+
+QLoggerField::QLoggerField(const QString &key, const char *value) :
+    _key(key), _type(Type::String), _string(QString::fromUtf8(value)) { _value.u = 0; }
+
+namespace {
+
+/*!
+ *  \brief Reads the monotonic clock
+ *  \return nanoseconds since an arbitrary point
+ */
+qint64 monotonicNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ *  \brief Appends s to out as a JSON string, quotes included
+ */
+void appendJsonString(QString& out, const QString& s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out += QLatin1Char('"');
+    for (const QChar c : s) {
+        const ushort u = c.unicode();
+        if (u == '"' || u == '\\') {
+            out += QLatin1Char('\\');
+            out += c;
+        }
+        else if (u >= 0x20) {
+            out += c;
+        }
+        else if (u == '\n') {
+            out += QLatin1String("\\n");
+        }
+        else if (u == '\r') {
+            out += QLatin1String("\\r");
+        }
+        else if (u == '\t') {
+            out += QLatin1String("\\t");
+        }
+        else {
+            out += QLatin1String("\\u00");
+            out += QLatin1Char(hex[u >> 4]);
+            out += QLatin1Char(hex[u & 0xf]);
+        }
+    }
+    out += QLatin1Char('"');
+}
+
+/*!
+ *  \brief Appends s to out as a logfmt value, quoted only if needed
+ */
+void appendKeyValueString(QString& out, const QString& s)
+{
+    bool quote = s.isEmpty();
+    for (const QChar c : s) {
+        const ushort u = c.unicode();
+        if (u <= ' ' || u == '=' || u == '"' || u == '\\') {
+            quote = true;
+            break;
+        }
+    }
+
+    if (!quote)
+        out += s;
+    else
+        appendJsonString(out, s);   // same escapes as logfmt
+}
+
+/*!
+ *  \brief Appends the value of a field to out, strings excluded
+ *  \param json whether numbers that JSON can't represent become null
+ */
+void appendNumber(QString& out, const QLoggerField& field, bool json)
+{
+    switch (field.type()) {
+    case QLoggerField::Type::Bool:
+        out += field.boolValue() ? QLatin1String("true") : QLatin1String("false");
+        break;
+    case QLoggerField::Type::Int:
+        out += QString::number(field.intValue());
+        break;
+    case QLoggerField::Type::UInt:
+        out += QString::number(field.uintValue());
+        break;
+    case QLoggerField::Type::Double:
+        if (json && !qIsFinite(field.doubleValue()))
+            out += QLatin1String("null");
+        else
+            out += QString::number(field.doubleValue(), 'g', QLocale::FloatingPointShortest);
+        break;
+    case QLoggerField::Type::String:
+        break;
+    }
+}
+
+/*!
+ *  \brief Appends fields to the body of a message
+ *  \param out the body of the message
+ *  \param fields
+ *  \param format
+ */
+void appendFields(QString& out, const QLoggerFields& fields, QLogger::FieldFormat format)
+{
+    if (fields.isEmpty())
+        return;
+
+    const bool json = format == QLogger::FieldFormat::Json;
+    if (!out.isEmpty())
+        out += QLatin1Char(' ');
+    if (json)
+        out += QLatin1Char('{');
+
+    for (int i = 0; i < fields.size(); ++i) {
+        const QLoggerField& field = fields.at(i);
+        if (i != 0)
+            out += json ? QLatin1Char(',') : QLatin1Char(' ');
+
+        if (json) {
+            appendJsonString(out, field.key());
+            out += QLatin1Char(':');
+        }
+        else {
+            out += field.key();
+            out += QLatin1Char('=');
+        }
+
+        if (field.type() != QLoggerField::Type::String)
+            appendNumber(out, field, json);
+        else if (json)
+            appendJsonString(out, field.stringValue());
+        else
+            appendKeyValueString(out, field.stringValue());
+    }
+
+    if (json)
+        out += QLatin1Char('}');
+}
+
+/*!
+ *  \brief The UTF-8 encoded body of a record
+ *  \param message the body given as a QString
+ *  \param utf8 the body given already encoded, used if not null
+ */
+QByteArray messageBody(const QString& message, const QByteArray& utf8)
+{
+    return utf8.isNull() ? message.toUtf8() : utf8;
+}
+
+}
+
+QLoggerHistogram::QLoggerHistogram() :
+    _counts(BucketCount, 0), _count(0) {}
+
+void QLoggerHistogram::record(qint64 nsecs)
+{
+    addToBucket(bucketOf(qMax<qint64>(nsecs, 0)), 1);
+}
+
+void QLoggerHistogram::addToBucket(int bucket, quint64 count)
+{
+    _counts[bucket] += count;
+    _count          += count;
+}
+
+void QLoggerHistogram::merge(const QLoggerHistogram &other)
+{
+    for (int i = 0; i < BucketCount; ++i)
+        _counts[i] += other._counts.at(i);
+    _count += other._count;
+}
+
+quint64 QLoggerHistogram::count() const
+{
+    return _count;
+}
+
+qint64 QLoggerHistogram::min() const
+{
+    for (int i = 0; i < BucketCount; ++i) {
+        if (_counts.at(i) != 0)
+            return lowerBound(i);
+    }
+    return 0;
+}
+
+qint64 QLoggerHistogram::max() const
+{
+    for (int i = BucketCount - 1; i >= 0; --i) {
+        if (_counts.at(i) != 0)
+            return upperBound(i);
+    }
+    return 0;
+}
+
+double QLoggerHistogram::mean() const
+{
+    if (_count == 0)
+        return 0;
+
+    double sum = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        if (_counts.at(i) != 0)
+            sum += _counts.at(i) * (lowerBound(i) / 2.0 + upperBound(i) / 2.0);
+    }
+    return sum / _count;
+}
+
+qint64 QLoggerHistogram::percentile(double percentile) const
+{
+    if (_count == 0)
+        return 0;
+
+    const double rank = qBound(0.0, percentile, 100.0) / 100.0 * _count;
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += _counts.at(i);
+        if (seen != 0 && seen >= rank)
+            return upperBound(i);
+    }
+    return max();
+}
+
+QString QLoggerHistogram::summary() const
+{
+    return QString("count=%1 p50=%2us p90=%3us p99=%4us p99.9=%5us max=%6us")
+            .arg(_count)
+            .arg(percentile(50) / 1000.0, 0, 'f', 1)
+            .arg(percentile(90) / 1000.0, 0, 'f', 1)
+            .arg(percentile(99) / 1000.0, 0, 'f', 1)
+            .arg(percentile(99.9) / 1000.0, 0, 'f', 1)
+            .arg(max() / 1000.0, 0, 'f', 1);
+}
+
+int QLoggerHistogram::bucketOf(qint64 nsecs)
+{
+    const quint64 value = static_cast<quint64>(nsecs);
+    if (value < SubBuckets)
+        return static_cast<int>(value);
+
+    int power = 0;  // floor(log2(value)), at least 4 here
+    for (quint64 v = value; v > 1; v >>= 1)
+        ++power;
+
+    const int sub = static_cast<int>((value >> (power - 4)) & (SubBuckets - 1));
+    return (power - 3) * SubBuckets + sub;
+}
+
+qint64 QLoggerHistogram::lowerBound(int bucket)
+{
+    if (bucket < SubBuckets)
+        return bucket;
+
+    const int power = bucket / SubBuckets + 3;
+    const int sub   = bucket % SubBuckets;
+    return static_cast<qint64>(SubBuckets + sub) << (power - 4);
+}
+
+qint64 QLoggerHistogram::upperBound(int bucket)
+{
+    if (bucket < SubBuckets)
+        return bucket;
+
+    const int power = bucket / SubBuckets + 3;
+    return lowerBound(bucket) + (qint64(1) << (power - 4)) - 1;
+}
+
+/*!
+ *  \brief Ring holding a copy of the latest messages for the crash handler
+ *  It's written by the producers with the logger mutex locked and read
+ *  without any lock by the signal handler, so it never allocates after
+ *  construction and positions only grow.
+ */
+class QLoggerCrashJournal
+{
+public:
+    explicit QLoggerCrashJournal(quint64 capacity) :
+        _buffer(new char[capacity]), _capacity(capacity), _head(0), _durable(0), _fd(-1) {}
+
+    /*!
+     *  \brief Copies data at the end of the ring, overwriting the oldest bytes
+     *  \return the new end of the journal
+     */
+    quint64 append(const QByteArray& data)
+    {
+        const quint64 head = _head.load();
+        const quint64 end  = head + static_cast<quint64>(data.size());
+
+        // only the last _capacity bytes can be kept anyway
+        const quint64 size  = qMin<quint64>(end - head, _capacity);
+        const char* bytes   = data.constData() + (end - head - size);
+
+        const quint64 offset    = (end - size) & (_capacity - 1);
+        const quint64 first     = qMin(size, _capacity - offset);
+        memcpy(_buffer.get() + offset, bytes, first);
+        memcpy(_buffer.get(), bytes + first, size - first);
+
+        _head.storeRelease(end);
+        return end;
+    }
+
+    quint64 head() const { return _head.loadAcquire(); }
+    quint64 durable() const { return _durable.loadAcquire(); }
+    quint64 capacity() const { return _capacity; }
+
+    void setDurable(quint64 position)
+    {
+        if (position > _durable.load())
+            _durable.storeRelease(position);
+    }
+
+    void setFileDescriptor(int fd) { _fd.storeRelease(fd); }
+
+    /*!
+     *  \brief Writes what hasn't been flushed yet, async-signal-safe
+     */
+    void dump() const
+    {
+#ifdef Q_OS_UNIX
+        const quint64 end   = _head.loadAcquire();
+        quint64 begin       = _durable.loadAcquire();
+        if (end - begin > _capacity)
+            begin = end - _capacity;
+
+        const int fd = _fd.loadAcquire() != -1 ? _fd.loadAcquire() : STDERR_FILENO;
+        while (begin < end) {
+            const quint64 offset    = begin & (_capacity - 1);
+            const quint64 chunk     = qMin(end - begin, _capacity - offset);
+
+            const ssize_t written = ::write(fd, _buffer.get() + offset, chunk);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                break;
+
+            begin += static_cast<quint64>(written);
+        }
+#endif
+    }
+
+private:
+    std::unique_ptr<char[]>     _buffer;    //!< the ring
+    const quint64               _capacity;  //!< size of _buffer, a power of 2
+    QAtomicInteger<quint64>     _head;      //!< bytes appended so far
+    QAtomicInteger<quint64>     _durable;   //!< bytes known to have been flushed
+    QAtomicInt                  _fd;        //!< where to dump, -1 for stderr
+};
+
+namespace {
+
+QAtomicPointer<QLoggerCrashJournal> crash_journals[QLogger::MaxCrashHandlers];    //!< journals to dump on a crash
+
+#ifdef Q_OS_UNIX
+const int           crash_signals[] = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL };
+struct sigaction    previous_actions[sizeof(crash_signals) / sizeof(crash_signals[0])];
+QAtomicInt          crash_handler_installed;
+
+void crashHandler(int signal)
+{
+    for (QAtomicPointer<QLoggerCrashJournal>& slot : crash_journals) {
+        const QLoggerCrashJournal* journal = slot.load();
+        if (journal != nullptr)
+            journal->dump();
+    }
+
+    for (std::size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); ++i) {
+        if (crash_signals[i] == signal)
+            sigaction(signal, &previous_actions[i], nullptr);
+    }
+    raise(signal);
+}
+
+/*!
+ *  \brief Alternate signal stack of a thread, freed when the thread ends
+ *  The crash handler runs there, so it still works after a stack overflow.
+ */
+class CrashStack
+{
+public:
+    static const std::size_t Size = 64 * 1024;     //!< bytes, more than the handler needs
+
+    CrashStack() : _stack(nullptr) {}
+
+    ~CrashStack()
+    {
+        if (_stack == nullptr)
+            return;
+
+        stack_t disable;
+        memset(&disable, 0, sizeof(disable));
+        disable.ss_flags = SS_DISABLE;
+        sigaltstack(&disable, nullptr);
+        free(_stack);
+    }
+
+    /*!
+     *  \brief Gives the calling thread an alternate signal stack, unless it has one
+     */
+    void install()
+    {
+        if (_stack != nullptr)
+            return;
+
+        stack_t current;
+        if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE))
+            return;     // set by someone else, e.g. a sanitizer
+
+        void* memory = malloc(Size);
+        if (memory == nullptr)
+            return;
+
+        stack_t stack;
+        memset(&stack, 0, sizeof(stack));
+        stack.ss_sp     = memory;
+        stack.ss_size   = Size;
+        if (sigaltstack(&stack, nullptr) == 0)
+            _stack = memory;
+        else
+            free(memory);
+    }
+
+private:
+    void*   _stack;     //!< the stack installed, null if none
+};
+
+thread_local CrashStack crash_stack;    //!< alternate signal stack of the current thread
+
+/*!
+ *  \brief Gives the calling thread an alternate signal stack once the crash handler is installed
+ */
+void installCrashStack()
+{
+    if (crash_handler_installed.load() != 0)
+        crash_stack.install();
+}
+
+void installCrashHandler()
+{
+    if (!crash_handler_installed.testAndSetOrdered(0, 1))
+        return;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler   = crashHandler;
+    action.sa_flags     = SA_ONSTACK;   // a stack overflow leaves no room on the thread's own stack
+    sigemptyset(&action.sa_mask);
+
+    for (std::size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); ++i)
+        sigaction(crash_signals[i], &action, &previous_actions[i]);
+}
+#endif
+
+}
+
+/*!
+ *  \brief Counters of a QLogger updated by one thread at a time
+ *  Each writing thread owns a block: updates are wrapped in a sequence lock,
+ *  so statistics() gets a consistent copy without ever blocking the writer.
+ */
+class QLoggerStatisticsBlock
+{
+public:
+    enum Counter {
+        Enqueued = 0,
+        Recorded,
+        Written,
+        Bytes,
+        WriteErrors,
+        Flushes,
+        Drops,
+        HighWater,
+        ProducerWaits,
+        ProducerWaitTime,
+        SchedulingRefusals,
+        Latency,                                        //!< first bucket of the histogram
+        CounterCount = Latency + QLogger::LatencyBuckets
+    };
+
+    QLoggerStatisticsBlock() : _sequence(0)
+    {
+        for (std::atomic<quint64>& counter : _counters)
+            counter.store(0, std::memory_order_relaxed);
+        for (std::atomic<quint64>& counter : _end_to_end)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+    /*!
+     *  \brief Starts an update, readers retry until endUpdate()
+     */
+    void beginUpdate()
+    {
+        _sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endUpdate()
+    {
+        _sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void add(Counter counter, quint64 value)
+    {
+        std::atomic<quint64>& c = _counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void raise(Counter counter, quint64 value)
+    {
+        std::atomic<quint64>& c = _counters[counter];
+        if (value > c.load(std::memory_order_relaxed))
+            c.store(value, std::memory_order_relaxed);
+    }
+
+    /*!
+     *  \brief Writes in a stream keeping track of bytes, errors and latencies
+     *  \param stream
+     *  \param data
+     *  \param level
+     *  \param timestamp milliseconds since the epoch the message was added at
+     *  \param category
+     *  \param enqueued_at monotonic time the message was enqueued at
+     *  \return what QLoggerStream::writeMessage() returned
+     */
+    qint64 write(QLoggerStream* stream, const QByteArray& data, QLogger::LogLevel level, qint64 timestamp,
+                 const QString& category, qint64 enqueued_at)
+    {
+        const qint64 start  = monotonicNow();
+        const qint64 bytes  = stream->writeMessage(data, static_cast<int>(level), timestamp, category);
+        const qint64 end    = monotonicNow();
+
+        beginUpdate();
+        if (bytes == -1)
+            add(WriteErrors, 1);
+        else
+            add(Bytes, static_cast<quint64>(bytes));
+        add(static_cast<Counter>(Latency + latencyBucket(end - start)), 1);
+
+        std::atomic<quint64>& bucket = _end_to_end[QLoggerHistogram::bucketOf(qMax<qint64>(end - enqueued_at, 0))];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        endUpdate();
+
+        return bytes;
+    }
+
+    /*!
+     *  \brief Flushes a stream counting it
+     *  \return what QLoggerStream::flush() returned
+     */
+    bool flush(QLoggerStream* stream)
+    {
+        const bool ok = stream->flush();
+
+        beginUpdate();
+        add(Flushes, 1);
+        endUpdate();
+
+        return ok;
+    }
+
+    /*!
+     *  \brief Adds a consistent copy of the counters to statistics
+     */
+    void addTo(QLogger::Statistics& statistics) const
+    {
+        quint64 values[CounterCount];
+        quint32 before;
+        quint32 after;
+        do {
+            before = _sequence.load(std::memory_order_acquire);
+            for (int i = 0; i < CounterCount; ++i)
+                values[i] = _counters[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = _sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) != 0 || before != after);
+
+        statistics.enqueued             += values[Enqueued];
+        statistics.recorded             += values[Recorded];
+        statistics.written              += values[Written];
+        statistics.bytes                += values[Bytes];
+        statistics.write_errors         += values[WriteErrors];
+        statistics.flushes              += values[Flushes];
+        statistics.drops                += values[Drops];
+        statistics.queue_high_water      = qMax(statistics.queue_high_water, values[HighWater]);
+        statistics.producer_waits       += values[ProducerWaits];
+        statistics.producer_wait_time   += values[ProducerWaitTime];
+        statistics.scheduling_refusals  += values[SchedulingRefusals];
+        for (int i = 0; i < QLogger::LatencyBuckets; ++i)
+            statistics.write_latency[i] += values[Latency + i];
+    }
+
+    /*!
+     *  \brief Adds a consistent copy of the end-to-end latencies to histogram
+     */
+    void addTo(QLoggerHistogram& histogram) const
+    {
+        std::unique_ptr<quint64[]> values(new quint64[QLoggerHistogram::BucketCount]);
+        quint32 before;
+        quint32 after;
+        do {
+            before = _sequence.load(std::memory_order_acquire);
+            for (int i = 0; i < QLoggerHistogram::BucketCount; ++i)
+                values[i] = _end_to_end[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = _sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) != 0 || before != after);
+
+        for (int i = 0; i < QLoggerHistogram::BucketCount; ++i) {
+            if (values[i] != 0)
+                histogram.addToBucket(i, values[i]);
+        }
+    }
+
+    /*!
+     *  \brief Index of the histogram bucket of a latency
+     *  \param nsecs latency in nanoseconds
+     *  \return 0 below 1 µs, otherwise 1 + log2 of the microseconds, clamped
+     */
+    static int latencyBucket(qint64 nsecs)
+    {
+        quint64 usecs = static_cast<quint64>(qMax<qint64>(nsecs, 0)) / 1000;
+
+        int bucket = 0;
+        while (usecs != 0 && bucket < QLogger::LatencyBuckets - 1) {
+            usecs >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+private:
+    std::atomic<quint32>    _sequence;                  //!< odd while an update is in progress
+    std::atomic<quint64>    _counters[CounterCount];    //!< indexed by Counter
+    std::atomic<quint64>    _end_to_end[QLoggerHistogram::BucketCount]; //!< end-to-end latency histogram
+};
+
+namespace {
+
+#ifdef Q_OS_LINUX
+/*!
+ *  \brief Pins the calling thread to some CPUs
+ *  \param cpus empty for all the CPUs, out of range indexes are ignored
+ *  \return false if refused, errno tells why
+ */
+bool setThreadAffinity(const QList<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.isEmpty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &set);
+    }
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+
+    const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    errno = error;
+    return error == 0;
+}
+
+/*!
+ *  \brief Sets the policy and the nice value of the calling thread
+ *  \param policy SCHED_OTHER, SCHED_BATCH...
+ *  \param nice nice value, per thread on Linux
+ *  \return the function that refused, errno telling why, or nullptr if both were applied
+ */
+const char* setThreadScheduling(int policy, int nice)
+{
+    sched_param param;
+    param.sched_priority = 0;
+    const int error = pthread_setschedparam(pthread_self(), policy, &param);
+
+    const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, nice) != 0)
+        return "setpriority";
+    if (error != 0) {
+        errno = error;
+        return "pthread_setschedparam";
+    }
+    return nullptr;
+}
+#endif
+
+/*!
+ *  \brief Locks a mutex measuring how long it had to wait for it
+ */
+class TimedMutexLocker
+{
+public:
+    explicit TimedMutexLocker(QMutex* mutex) : _mutex(mutex), _waited(-1)
+    {
+        if (!_mutex->tryLock()) {
+            QElapsedTimer timer;
+            timer.start();
+            _mutex->lock();
+            _waited = timer.nsecsElapsed();
+        }
+    }
+
+    ~TimedMutexLocker() { _mutex->unlock(); }
+
+    /*!
+     *  \return the nanoseconds spent waiting, -1 if the mutex was free
+     */
+    qint64 waited() const { return _waited; }
+
+private:
+    QMutex* _mutex;
+    qint64  _waited;
+};
+
+thread_local int inside_logger = 0;     //!< > 0 while the thread runs QLogger code
+
+/*!
+ *  \brief Marks the current thread as running QLogger code for its lifetime
+ *  Qt messages emitted meanwhile, e.g. QLogger's own qDebug() traces, don't go
+ *  back in a logger. \sa QLogger::installMessageHandler()
+ */
+class InsideLogger
+{
+public:
+    InsideLogger()  { ++inside_logger; }
+    ~InsideLogger() { --inside_logger; }
+};
+
+QAtomicPointer<QLogger> message_handler_logger;             //!< logger receiving Qt's messages, if any
+QtMessageHandler        previous_message_handler = nullptr; //!< restored by uninstallMessageHandler()
+
+/*!
+ *  \brief Maps the type of a Qt message to a QLogger level
+ */
+QLogger::LogLevel fromQtMsgType(QtMsgType type)
+{
+    switch (type) {
+    case QtDebugMsg:    return QLogger::LogLevel::Debug;
+    case QtInfoMsg:     return QLogger::LogLevel::Info;
+    case QtWarningMsg:  return QLogger::LogLevel::Warning;
+    case QtCriticalMsg: return QLogger::LogLevel::Warning;
+    case QtFatalMsg:    return QLogger::LogLevel::Fatal;
+    }
+    return QLogger::LogLevel::Info;
+}
+
+/*!
+ *  \brief The Qt message handler installed by QLogger::installMessageHandler()
+ */
+void qtMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    QLogger* logger = message_handler_logger.loadAcquire();
+    if (logger == nullptr || inside_logger > 0) {
+        // QLogger talking about itself would feed itself forever
+        if (previous_message_handler)
+            previous_message_handler(type, context, message);
+        return;
+    }
+
+    InsideLogger guard;
+
+    QLoggerFields fields;
+    if (context.file) {
+        fields.reserve(3);
+        fields.append(QLoggerField("file", context.file));
+        fields.append(QLoggerField("line", context.line));
+        if (context.function)
+            fields.append(QLoggerField("function", context.function));
+    }
+
+    const QString category = context.category && std::strcmp(context.category, "default") != 0
+            ? QString::fromLatin1(context.category) : QString("qt");
+
+    logger->addMessage(message, fromQtMsgType(type), fields, category);
+
+    if (type == QtFatalMsg) {
+        // Qt aborts as soon as this returns
+        if (logger->isWriting() && QThread::currentThread() != logger)
+            logger->flush(true).waitForFinished();
+        else if (previous_message_handler)
+            previous_message_handler(type, context, message);
+    }
+}
+
+}
+
+/*!
+ *  \brief Thread writing a single stream of a QLogger
+ *  It has its own queue so that a slow stream doesn't hold back the others.
+ */
+class QLogger::SinkWriter : public QThread
+{
+public:
+    explicit SinkWriter(QLoggerStream* stream) :
+        QThread(), _stream(stream), _finish(false), _stopped(false), _write_ok(true),
+        _error_string(std::make_shared<const QString>()) {}
+
+    void enqueue(const Record& record, bool priority)
+    {
+        QMutexLocker locker(&_mutex);
+        if (_stopped) {
+            if (record.barrier)
+                releaseFlush(*record.barrier, false);
+            return;
+        }
+
+        if (priority)
+            _priority_records.enqueue(record);
+        else
+            _records.enqueue(record);
+        _empty.wakeOne();
+    }
+
+    void finishWriting()
+    {
+        QMutexLocker locker(&_mutex);
+        _finish = true;
+        _empty.wakeOne();
+    }
+
+    QString errorString() const
+    {
+        return *std::atomic_load(&_error_string);  // no lock, it's polled while writing
+    }
+
+    const QLoggerStatisticsBlock& statistics() const { return _statistics; }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        InsideLogger guard;
+#ifdef Q_OS_UNIX
+        installCrashStack();
+#endif
+
+        if (!_stream->open()) {
+            std::atomic_store(&_error_string, std::make_shared<const QString>(_stream->errorString()));
+            QMutexLocker locker(&_mutex);
+            _stream->close();
+            stop();
+            return;
+        }
+
+        forever {
+            _mutex.lock();
+            if (_records.isEmpty() && _priority_records.isEmpty() && !_finish) {
+                _mutex.unlock();
+                _stream->drained();
+                _mutex.lock();
+            }
+            while (_records.isEmpty() && _priority_records.isEmpty() && !_finish)
+                _empty.wait(&_mutex);
+
+            if (_records.isEmpty() && _priority_records.isEmpty()) {
+                _mutex.unlock();
+                break;
+            }
+
+            const Record record = _priority_records.isEmpty() ? _records.dequeue()
+                                                              : _priority_records.dequeue();
+            _mutex.unlock();
+
+            if (record.barrier) {
+                bool ok = _write_ok;
+                if (record.barrier->sync)
+                    ok = _statistics.flush(_stream) && ok;
+
+                releaseFlush(*record.barrier, ok);
+                _write_ok = true;
+            }
+            else if (_statistics.write(_stream, record.data, record.level, record.timestamp,
+                                            record.category, record.enqueued_at) == -1) {
+                _write_ok = false;
+            }
+        }
+        _stream->close();
+
+        QMutexLocker locker(&_mutex);
+        stop();
+    }
+
+private:
+    void stop()
+    {
+        _stopped = true;
+        for (const Record& record : _records) {
+            if (record.barrier)
+                releaseFlush(*record.barrier, false);
+        }
+        _records.clear();
+        _priority_records.clear();  // barriers are never there
+    }
+
+    QLoggerStream*      _stream;        //!< stream to write, owned by the logger
+    QQueue<Record>      _records;           //!< records to write
+    QQueue<Record>      _priority_records;  //!< records to write before _records
+
+    mutable QMutex      _mutex;         //!< protects everything but _stream and _write_ok
+    QWaitCondition      _empty;         //!< allows to wait while there aren't records to be written
+    bool                _finish;        //!< set by finishWriting()
+    bool                _stopped;       //!< set when run() is over
+    bool                _write_ok;      //!< false if a write failed since the last barrier
+
+    std::shared_ptr<const QString>  _error_string;  //!< description of the last error, swapped atomically
+
+    QLoggerStatisticsBlock  _statistics;    //!< counters of this thread
+};
+
+QLogger::QLogger(stream_ptr stream, QObject *parent) :
+    QThread(parent), _sinks(1)
+{
+    _sinks.front().stream   = std::move(stream);
+    _sinks.front().level    = severityRank(LogLevel::Debug);    // everything is written
+    _sinks.front().write_ok = true;
+
+    _finish.store(0);
+    _messages_size.store(0);
+
+    _producer_statistics.reset(new QLoggerStatisticsBlock);
+    _writer_statistics.reset(new QLoggerStatisticsBlock);
+    _summary_interval.store(0);
+    _last_summary = 0;
+
+    _field_format.store(static_cast<int>(FieldFormat::KeyValue));
+    _output_format.store(static_cast<int>(OutputFormat::Text));
+
+    _stopped        = false;
+
+    _flight_level   = severityRank(LogLevel::Debug);    // nothing is below Debug
+    _flight_threshold.store(_flight_level);
+    _flight_next    = 0;
+    _flight_count   = 0;
+
+    _priority_level.store(severityRank(LogLevel::Fatal));
+    _synchronous_threshold.store(-1);
+
+    for (route_mask& mask : _routes.levels)
+        mask = ~route_mask(0);
+    _category_generation.store(1);
+    _routes_generation.store(1);
+    _writer_routes_generation = 0;  // forces the first copy
+
+    _scheduling.pinned      = false;
+    _scheduling.policy      = static_cast<int>(SchedulingPolicy::Inherit);
+    _scheduling.nice        = 0;
+    _scheduling.raised_nice = -5;
+    _scheduling_generation.store(1);
+    _adaptive_threshold.store(-1);
+    _writer_scheduling_generation   = 0;
+    _writer_raised                  = false;
+    _writer_base_policy             = 0;
+    _writer_base_nice               = 0;
+    _pool.store(nullptr);
+
+    _error_string   = std::make_shared<const QString>();
+    _format         = compileFormat("[%1] %2 %3", "dd.MM.yyyy hh:mm:ss");
+}
+
+QLogger::~QLogger()
+{
+    if (message_handler_logger.loadAcquire() == this)
+        uninstallMessageHandler();
+
+    QLoggerWriterPool* pool = _pool.loadAcquire();
+    if (pool) {
+        finishWriting();
+        pool->wait(this);
+    }
+
+    {
+        QMutexLocker locker(&_mutex);
+        failPendingFlushes();   // nobody is going to write them anymore
+    }
+
+    for (QAtomicPointer<QLoggerCrashJournal>& slot : crash_journals)
+        slot.testAndSetOrdered(_journal.get(), nullptr);
+
+    for (Sink& sink : _sinks) {
+        if (sink.writer) {
+            sink.writer->finishWriting();
+            sink.writer->wait();
+        }
+
+        if (sink.stream->isOpen())
+            sink.stream->close();   // RAII
+    }
+}
+
+int QLogger::addStream(stream_ptr stream, const LogLevel &level, bool threaded)
+{
+    if (isWriting() || _sinks.size() >= MaxStreams)
+        return -1;
+
+    _sinks.emplace_back();
+
+    Sink& sink      = _sinks.back();
+    sink.stream     = std::move(stream);
+    sink.level      = severityRank(level);
+    sink.write_ok   = true;
+    if (threaded)
+        sink.writer.reset(new SinkWriter(sink.stream.get()));
+
+    return static_cast<int>(_sinks.size()) - 1;
+}
+
+bool QLogger::enableCrashHandler(int journalSize)
+{
+#ifdef Q_OS_UNIX
+    if (isWriting() || _journal || journalSize <= 0)
+        return false;
+
+    quint64 capacity = 1;
+    while (capacity < static_cast<quint64>(journalSize))
+        capacity <<= 1;
+
+    std::unique_ptr<QLoggerCrashJournal> journal(new QLoggerCrashJournal(capacity));
+    for (QAtomicPointer<QLoggerCrashJournal>& slot : crash_journals) {
+        if (slot.testAndSetOrdered(nullptr, journal.get())) {
+            _journal = std::move(journal);
+            installCrashHandler();
+            installCrashStack();
+            return true;
+        }
+    }
+#else
+    Q_UNUSED(journalSize);
+#endif
+
+    return false;
+}
+
+void QLogger::installMessageHandler(QLogger *logger)
+{
+    if (logger == nullptr) {
+        uninstallMessageHandler();
+        return;
+    }
+
+    QLogger* const previous = message_handler_logger.fetchAndStoreOrdered(logger);
+    if (previous == nullptr)
+        previous_message_handler = qInstallMessageHandler(qtMessageHandler);
+}
+
+void QLogger::uninstallMessageHandler()
+{
+    if (message_handler_logger.fetchAndStoreOrdered(nullptr) != nullptr)
+        qInstallMessageHandler(previous_message_handler);
+}
+
+int QLogger::streamCount() const
+{
+    return static_cast<int>(_sinks.size());
+}
+
+QLogger::stream_ptr& QLogger::stream(int index)
+{
+    return _sinks.at(index).stream;
+}
+
+QThread* QLogger::streamThread(int index)
+{
+    const Sink& sink = _sinks.at(index);
+    if (sink.writer)
+        return sink.writer.get();
+
+    return this;
+}
+
+QLogger::LogLevel QLogger::streamLevel(int index) const
+{
+    return levelOfRank(_sinks.at(index).level.load());
+}
+
+void QLogger::setStreamLevel(int index, const LogLevel &level)
+{
+    _sinks.at(index).level.store(severityRank(level));
+}
+
+void QLogger::addMessage(const QString &message, const LogLevel &level, const QString &category)
+{
+    addMessage(message, level, QLoggerFields(), category);
+}
+
+void QLogger::addMessage(const QString &message, const LogLevel &level, const QLoggerFields &fields,
+                         const QString &category)
+{
+    addRecord(message, level, fields, category, true);
+}
+
+void QLogger::addRecord(const QString &message, const LogLevel &level, const QLoggerFields &fields,
+                        const QString &category, bool filter, const std::shared_ptr<LazyMessage> &lazy)
+{
+    addRecord(message, QByteArray(), level, fields, category, filter, lazy);
+}
+
+void QLogger::addRecord(const QByteArray &utf8, const LogLevel &level, const QLoggerFields &fields,
+                        const QString &category, bool filter)
+{
+    addRecord(QString(), utf8, level, fields, category, filter, std::shared_ptr<LazyMessage>());
+}
+
+void QLogger::addRecord(const QString &message, const QByteArray &utf8, const LogLevel &level,
+                        const QLoggerFields &fields, const QString &category, bool filter,
+                        const std::shared_ptr<LazyMessage> &lazy)
+{
+    InsideLogger guard;
+#ifdef Q_OS_UNIX
+    if (_journal)
+        installCrashStack();
+#endif
+
+    Record record;
+    record.level        = level;
+    record.category     = category;
+    record.journal_end  = 0;
+    record.enqueued_at  = monotonicNow();
+
+    QVector<Record> records;    // written synchronously, the Fatal message last
+    {
+        TimedMutexLocker locker(&_mutex);
+        const QDateTime datetime = QDateTime::currentDateTime();
+        record.timestamp = QDateTime::currentMSecsSinceEpoch();
+
+        if (locker.waited() >= 0) {
+            _producer_statistics->beginUpdate();
+            _producer_statistics->add(QLoggerStatisticsBlock::ProducerWaits, 1);
+            _producer_statistics->add(QLoggerStatisticsBlock::ProducerWaitTime,
+                                      static_cast<quint64>(locker.waited()));
+            _producer_statistics->endUpdate();
+        }
+
+        if (filter && _category_levels
+                && severityRank(level) < categoryThreshold(_category_levels.get(), category))
+            return;
+
+        if (severityRank(level) < _flight_level && !_flight_records.isEmpty()) {
+            _producer_statistics->beginUpdate();
+            _producer_statistics->add(QLoggerStatisticsBlock::Recorded, 1);
+            if (_flight_count == _flight_records.size())
+                _producer_statistics->add(QLoggerStatisticsBlock::Drops, 1);   // the oldest is overwritten
+            _producer_statistics->endUpdate();
+
+            // recorded only, no formatting nor I/O until a dump
+            FlightRecord& flight = _flight_records[_flight_next];
+            flight.datetime = datetime;
+            flight.level    = level;
+            flight.category = category;
+            flight.message  = message;
+            flight.utf8     = utf8;
+            flight.fields   = fields;
+            flight.lazy     = lazy;
+
+            _flight_next = (_flight_next + 1) % _flight_records.size();
+            _flight_count = qMin(_flight_count + 1, _flight_records.size());
+            return;
+        }
+
+        const int threshold = _synchronous_threshold.load();
+        const bool synchronous = level == LogLevel::Fatal && threshold >= 0
+                && _messages_size.load() > threshold && isWriting();
+
+        // the context goes out right before the Fatal message, written with it if synchronous
+        if (level == LogLevel::Fatal)
+            dumpFlightRecords(true, synchronous ? &records : nullptr);
+
+        // addLazyRecord() never leaves a message to build when it must be formatted here
+        Q_ASSERT(!lazy || !(synchronous || _journal));
+
+        if ((fields.isEmpty() && !lazy) || synchronous || _journal) {
+            record.data = formatMessage(datetime, level, category, messageBody(message, utf8), fields);
+        }
+        else {
+            // formatted by run(), the fields are rendered out of the producer's way
+            record.datetime = datetime;
+            record.message  = message;
+            record.utf8     = utf8;
+            record.fields   = fields;
+            record.lazy     = lazy;
+        }
+
+        _producer_statistics->beginUpdate();
+        _producer_statistics->add(QLoggerStatisticsBlock::Enqueued, 1);
+        _producer_statistics->endUpdate();
+
+        if (!synchronous) {
+            enqueue(record, isPriority(level));
+            return;
+        }
+    }
+
+    records.append(record);
+    writeSynchronously(records);
+}
+
+void QLogger::addLazyRecord(const std::shared_ptr<LazyMessage> &message, const LogLevel &level,
+                            const QString &category)
+{
+    if (level == LogLevel::Fatal || _journal)
+        addRecord(message->evaluate(), level, QLoggerFields(), category, false);
+    else
+        addRecord(QString(), level, QLoggerFields(), category, false, message);
+}
+
+bool QLogger::isEnabled(const LogLevel &level, const QString &category) const
+{
+    const int rank = severityRank(level);
+
+    if (rank < categoryThreshold(category))
+        return false;
+
+    if (rank < _flight_threshold.load())
+        return true;
+
+    // _sinks doesn't change once the logger has started, the levels are atomic
+    for (const Sink& sink : _sinks) {
+        if (rank >= sink.level.load())
+            return true;
+    }
+    return false;
+}
+
+QByteArray QLogger::formatMessage(const QDateTime &datetime, const LogLevel &level, const QString &category,
+                                  const QByteArray &message, const QLoggerFields &fields) const
+{
+    const QString levelString = logLevelToString(level);
+
+    if (static_cast<OutputFormat>(_output_format.load()) == OutputFormat::JsonLines)
+        return formatJsonLine(datetime, levelString, category, message, fields);
+
+    QByteArray body = message;
+    if (!fields.isEmpty()) {
+        QString text;
+        appendFields(text, fields, static_cast<FieldFormat>(_field_format.load()));
+        if (!body.isEmpty())
+            body += ' ';
+        body += text.toUtf8();
+    }
+
+    const format_ptr format = std::atomic_load(&_format);
+    const QByteArray values[] = { datetime.toString(format->datetime_format).toUtf8(),
+                                  levelString.toUtf8(), body };
+
+    int size = 1;
+    for (const QByteArray& literal : format->literals)
+        size += literal.size();
+    for (int argument : format->arguments)
+        size += values[argument].size();
+
+    QByteArray line;
+    line.reserve(size);
+    for (int i = 0; i < format->arguments.size(); ++i) {
+        line += format->literals.at(i);
+        line += values[format->arguments.at(i)];
+    }
+    line += format->literals.last();
+    line += '\n';
+
+    return line;
+}
+
+QLogger::format_ptr QLogger::compileFormat(const QString &formatString, const QString &datetimeFormat)
+{
+    std::shared_ptr<FormatSnapshot> format = std::make_shared<FormatSnapshot>();
+    format->format_string   = formatString;
+    format->datetime_format = datetimeFormat;
+
+    QString literal;
+    for (int i = 0; i < formatString.size(); ++i) {
+        const QChar c       = formatString.at(i);
+        const QChar next    = i + 1 < formatString.size() ? formatString.at(i + 1) : QChar();
+        const QChar after   = i + 2 < formatString.size() ? formatString.at(i + 2) : QChar();
+
+        if (c == QLatin1Char('%') && next.unicode() >= '1' && next.unicode() <= '3' && !after.isDigit()) {
+            format->literals.append(literal.toUtf8());
+            format->arguments.append(next.unicode() - '1');
+            literal.clear();
+            ++i;
+        }
+        else {
+            literal += c;
+        }
+    }
+    format->literals.append(literal.toUtf8());
+
+    return format;
+}
+
+QByteArray QLogger::formatJsonLine(const QDateTime &datetime, const QString &levelString,
+                                   const QString &category, const QByteArray &message,
+                                   const QLoggerFields &fields)
+{
+    QByteArray line;
+    line.reserve(64 + message.size() + category.size() + fields.size() * 32);
+
+    line += "{\"ts\":";
+    QLoggerJson::appendString(line, datetime.toUTC().toString(Qt::ISODateWithMs)); // ends with Z
+    line += ",\"level\":";
+    QLoggerJson::appendString(line, levelString);
+    line += ",\"msg\":";
+    QLoggerJson::appendString(line, message.constData(), message.size());
+    if (!category.isEmpty()) {
+        line += ",\"category\":";
+        QLoggerJson::appendString(line, category);
+    }
+
+    for (const QLoggerField& field : fields) {
+        line += ',';
+        QLoggerJson::appendString(line, field.key());
+        line += ':';
+
+        switch (field.type()) {
+        case QLoggerField::Type::Bool:
+            line += field.boolValue() ? "true" : "false";
+            break;
+        case QLoggerField::Type::Int:
+            line += QByteArray::number(field.intValue());
+            break;
+        case QLoggerField::Type::UInt:
+            line += QByteArray::number(field.uintValue());
+            break;
+        case QLoggerField::Type::Double:
+            if (qIsFinite(field.doubleValue()))
+                line += QString::number(field.doubleValue(), 'g', QLocale::FloatingPointShortest).toLatin1();
+            else
+                line += "null";
+            break;
+        case QLoggerField::Type::String:
+            QLoggerJson::appendString(line, field.stringValue());
+            break;
+        }
+    }
+
+    line += "}\n";
+    return line;
+}
+
+void QLogger::enqueue(Record &record, bool priority)
+{
+    if (_journal)
+        record.journal_end = _journal->append(record.data);
+
+    if (priority)
+        _priority_messages.enqueue(record);
+    else
+        _messages.enqueue(record);
+    _messages_size.store(_messages.size() + _priority_messages.size());
+
+    _producer_statistics->beginUpdate();
+    _producer_statistics->raise(QLoggerStatisticsBlock::HighWater,
+                                static_cast<quint64>(_messages_size.load()));
+    _producer_statistics->endUpdate();
+
+    // woken while holding the mutex so run() can't miss it between its check and wait
+    wakeWriter();
+}
+
+void QLogger::dumpFlightRecords(bool priority, QVector<Record>* records)
+{
+    const int size  = _flight_records.size();
+    const int first = (_flight_next - _flight_count + size) % qMax(size, 1);
+
+    for (int i = 0; i < _flight_count; ++i) {
+        FlightRecord& flight = _flight_records[(first + i) % size];
+
+        Record record;
+        record.level        = flight.level;
+        record.category     = flight.category;
+        record.journal_end  = 0;
+        record.enqueued_at  = monotonicNow();
+        record.timestamp    = flight.datetime.toMSecsSinceEpoch();
+        if (flight.lazy) {
+            // built by the writer, not here with _mutex locked
+            record.datetime = flight.datetime;
+            record.lazy     = flight.lazy;
+        }
+        else {
+            record.data = formatMessage(flight.datetime, flight.level, flight.category,
+                                        messageBody(flight.message, flight.utf8), flight.fields);
+        }
+
+        if (records != nullptr)
+            records->append(record);
+        else
+            enqueue(record, priority);
+
+        flight.message.clear();     // don't keep large messages alive
+        flight.utf8.clear();
+        flight.fields.clear();
+        flight.lazy.reset();
+    }
+
+    _producer_statistics->beginUpdate();
+    _producer_statistics->add(QLoggerStatisticsBlock::Enqueued, static_cast<quint64>(_flight_count));
+    _producer_statistics->endUpdate();
+
+    _flight_count = 0;
+}
+
+void QLogger::dumpFlightRecorder()
+{
+    QMutexLocker locker(&_mutex);
+    dumpFlightRecords(false);
+}
+
+void QLogger::writeSynchronously(QVector<Record> &records)
+{
+    for (Record& record : records)
+        formatDeferred(record);
+
+    QMutexLocker writing(&_write_mutex);
+    for (const Record& record : records)
+        dispatch(record);
+
+    for (Sink& sink : _sinks) {
+        if (!sink.writer && sink.stream->isOpen() && !_writer_statistics->flush(sink.stream.get()))
+            sink.write_ok = false;
+    }
+}
+
+bool QLogger::isPriority(const LogLevel &level) const
+{
+    return severityRank(level) >= _priority_level.load();
+}
+
+QFuture<bool> QLogger::flush(bool sync)
+{
+    std::shared_ptr<FlushRequest> request(new FlushRequest);
+    request->sync = sync;
+    request->pending.store(1);
+    request->failed.store(0);
+    request->promise.reportStarted();
+    QFuture<bool> future = request->promise.future();
+
+    QMutexLocker locker(&_mutex);
+    if (_stopped) {
+        finishFlush(*request, false);
+        return future;
+    }
+
+    Record record;
+    record.level        = LogLevel::Info;
+    record.journal_end  = 0;
+    record.enqueued_at  = monotonicNow();
+    record.timestamp    = 0;
+    record.barrier      = request;
+    _messages.enqueue(record);
+    _messages_size.store(_messages.size() + _priority_messages.size());
+    wakeWriter();
+    return future;
+}
+
+void QLogger::run()
+{
+    InsideLogger guard;
+
+#ifdef Q_OS_LINUX
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &_writer_base_policy, &param) != 0)
+        _writer_base_policy = SCHED_OTHER;
+    errno = 0;
+    _writer_base_nice = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+    if (errno != 0)
+        _writer_base_nice = 0;
+#endif
+    _writer_scheduling_generation   = 0;
+    _writer_raised                  = false;
+    updateScheduling();     // before the threaded streams start, so they inherit it
+
+    if (!openStreams())
+        return;
+
+    while ( !_finish.load() || _messages_size.load() != 0) {
+        updateScheduling();
+
+        if (!writeNext() && !_finish.load()) {
+            drainStreams();
+            syncIdleJournal();
+
+            qDebug() << "QLogger::run()----->Must wait";
+            _mutex.lock();
+            if (_messages.isEmpty() && _priority_messages.isEmpty() && !_finish.load())
+                _empty.wait(&_mutex);
+            _mutex.unlock();
+        }
+    }
+
+    closeStreams();
+}
+
+bool QLogger::openStreams()
+{
+#ifdef Q_OS_UNIX
+    installCrashStack();    // on the writer thread, a pool's included
+#endif
+
+    _write_mutex.lock();
+    int opened = 0;
+    for (Sink& sink : _sinks) {
+        if (sink.writer) {
+            sink.writer->start(priority());
+            ++opened;
+        }
+        else if (sink.stream->open()) {
+            ++opened;
+        }
+        else {
+            std::atomic_store(&_error_string, std::make_shared<const QString>(sink.stream->errorString()));
+            sink.stream->close();
+            sink.write_ok = false;
+        }
+    }
+
+    if (_journal)
+        _journal->setFileDescriptor(_sinks.front().stream->isOpen() ? _sinks.front().stream->handle() : -1);
+    _write_mutex.unlock();
+
+    if (opened == 0) {
+        QMutexLocker locker(&_mutex);
+        _stopped = true;
+        _pool.storeRelease(nullptr);
+        failPendingFlushes();
+        return false;
+    }
+
+    return true;
+}
+
+void QLogger::formatDeferred(Record &record) const
+{
+    if (!record.data.isNull() || record.barrier)
+        return;
+
+    if (record.lazy)
+        record.message = record.lazy->evaluate();
+    record.data = formatMessage(record.datetime, record.level, record.category,
+                                messageBody(record.message, record.utf8), record.fields);
+    record.message.clear();
+    record.utf8.clear();
+    record.fields.clear();
+    record.lazy.reset();
+}
+
+bool QLogger::writeNext()
+{
+    if (_messages_size.load() == 0)
+        return false;
+
+    _mutex.lock();
+    Record record = _priority_messages.isEmpty() ? _messages.dequeue()
+                                                 : _priority_messages.dequeue();
+    _messages_size.store(_messages.size() + _priority_messages.size());
+
+    const bool deferred = record.data.isNull() && !record.barrier;
+    _mutex.unlock();
+
+    if (deferred)
+        formatDeferred(record);
+
+    {
+        QMutexLocker writing(&_write_mutex);
+        dispatch(record);
+    }
+
+    summarizeLatency();
+    return true;
+}
+
+void QLogger::syncIdleJournal()
+{
+    if (!_journal)
+        return;
+
+    // everything enqueued so far has been written, make it durable
+    _mutex.lock();
+    const bool idle     = _messages.isEmpty() && _priority_messages.isEmpty();
+    const quint64 end   = _journal->head();
+    _mutex.unlock();
+
+    QMutexLocker writing(&_write_mutex);
+    if (idle && end > _journal->durable())
+        syncJournal(end);
+}
+
+void QLogger::drainStreams()
+{
+    QMutexLocker writing(&_write_mutex);
+    for (Sink& sink : _sinks) {
+        if (!sink.writer && sink.stream->isOpen())
+            sink.stream->drained();     // threaded streams are told by their own writer
+    }
+}
+
+void QLogger::closeStreams()
+{
+    _write_mutex.lock();
+    for (Sink& sink : _sinks) {
+        if (sink.writer) {
+            sink.writer->finishWriting();
+            sink.writer->wait();
+        }
+        else if (sink.stream->isOpen()) {
+            sink.stream->close();
+        }
+    }
+
+    if (_journal) {
+        // closing flushed everything, later messages will be dumped in stderr
+        QMutexLocker locker(&_mutex);
+        _journal->setFileDescriptor(-1);
+        _journal->setDurable(_journal->head());
+    }
+    _write_mutex.unlock();
+
+    QMutexLocker locker(&_mutex);
+    _stopped = true;
+    _pool.storeRelease(nullptr);
+    failPendingFlushes();   // the queue is empty, but flush() may have raced with us
+    qDebug() << "QLogger::run()----->End run";
+}
+
+bool QLogger::isWriting() const
+{
+    return isRunning() || _pool.loadAcquire() != nullptr;
+}
+
+void QLogger::wakeWriter()
+{
+    QLoggerWriterPool* pool = _pool.loadAcquire();
+    if (pool)
+        pool->wake();
+    else
+        _empty.wakeOne();
+}
+
+void QLogger::dispatch(const Record &record)
+{
+    if (record.barrier) {
+        FlushRequest& request = *record.barrier;
+
+        bool ok = true;
+        for (Sink& sink : _sinks) {
+            if (sink.writer) {
+                request.pending.ref();
+                sink.writer->enqueue(record, false);
+                continue;
+            }
+
+            if (!sink.stream->isOpen()) {
+                ok = false;
+                continue;
+            }
+
+            ok = sink.write_ok && ok;
+            if (request.sync)
+                ok = _writer_statistics->flush(sink.stream.get()) && ok;
+            sink.write_ok = true;
+        }
+
+        releaseFlush(request, ok);
+        return;
+    }
+
+    const int rank          = severityRank(record.level);
+    const bool priority     = isPriority(record.level);
+    const route_mask mask   = route(record);
+    int dropped             = 0;
+    for (std::size_t i = 0; i < _sinks.size(); ++i) {
+        Sink& sink = _sinks[i];
+        if (!(mask & (route_mask(1) << i)) || rank < sink.level.load())
+            continue;
+
+        if (sink.writer)
+            sink.writer->enqueue(record, priority);
+        else if (!sink.stream->isOpen())
+            ++dropped;
+        else if (_writer_statistics->write(sink.stream.get(), record.data, record.level, record.timestamp,
+                                              record.category, record.enqueued_at) == -1)
+            sink.write_ok = false;
+    }
+
+    _writer_statistics->beginUpdate();
+    _writer_statistics->add(QLoggerStatisticsBlock::Written, 1);
+    _writer_statistics->add(QLoggerStatisticsBlock::Drops, static_cast<quint64>(dropped));
+    _writer_statistics->endUpdate();
+
+    // priority messages overtake others, so only ordinary ones mark a prefix as written
+    if (_journal && !priority && record.journal_end != 0
+            && record.journal_end - _journal->durable() > _journal->capacity() / 2)
+        syncJournal(record.journal_end);
+}
+
+void QLogger::summarizeLatency()
+{
+    const int interval = _summary_interval.load();
+    if (interval <= 0)
+        return;
+
+    const qint64 now = monotonicNow();
+    if (_last_summary == 0) {
+        _last_summary = now;    // the first interval starts with the first message
+        return;
+    }
+
+    if (now - _last_summary < qint64(interval) * 1000000)
+        return;
+
+    _last_summary = now;
+    addMessage("end-to-end latency " + endToEndLatency().summary(), LogLevel::Info, "qlogger");
+}
+
+void QLogger::syncJournal(quint64 end)
+{
+    for (Sink& sink : _sinks) {
+        if (!sink.writer && sink.stream->isOpen() && !_writer_statistics->flush(sink.stream.get()))
+            sink.write_ok = false;
+    }
+
+    _journal->setDurable(end);
+}
+
+void QLogger::updateScheduling()
+{
+#ifdef Q_OS_LINUX
+    const int threshold = _adaptive_threshold.load();
+    bool raised         = _writer_raised;
+    if (threshold < 0)
+        raised = false;
+    else if (!raised)
+        raised = _messages_size.load() > threshold;
+    else
+        raised = _messages_size.load() != 0;
+
+    const int generation = _scheduling_generation.load();
+    if (generation == _writer_scheduling_generation && raised == _writer_raised)
+        return;
+
+    _mutex.lock();
+    const Scheduling scheduling     = _scheduling;
+    const bool changed              = generation != _writer_scheduling_generation;
+    _writer_scheduling_generation   = _scheduling_generation.load();
+    _mutex.unlock();
+
+    const char* refused = nullptr;
+    if (changed && scheduling.pinned && !setThreadAffinity(scheduling.cpus))
+        refused = "pthread_setaffinity_np";
+    const int affinity_errno = errno;
+
+    const SchedulingPolicy policy = static_cast<SchedulingPolicy>(scheduling.policy);
+    const char* scheduling_refused = nullptr;
+    if (raised)
+        scheduling_refused = setThreadScheduling(SCHED_OTHER, qMin(scheduling.raised_nice, _writer_base_nice));
+    else if (policy == SchedulingPolicy::Normal)
+        scheduling_refused = setThreadScheduling(SCHED_OTHER, scheduling.nice);
+    else if (policy == SchedulingPolicy::Batch)
+        scheduling_refused = setThreadScheduling(SCHED_BATCH, scheduling.nice);
+    else if (_writer_raised || changed)
+        scheduling_refused = setThreadScheduling(_writer_base_policy, _writer_base_nice);
+
+    if (scheduling_refused)
+        refused = scheduling_refused;
+    else if (refused)
+        errno = affinity_errno;
+
+    if (refused) {
+        // typically EPERM: lowering the nice value needs CAP_SYS_NICE or a RLIMIT_NICE allowing it
+        std::atomic_store(&_error_string, std::make_shared<const QString>(errnoString(refused)));
+        QMutexLocker locker(&_write_mutex);
+        _writer_statistics->beginUpdate();
+        _writer_statistics->add(QLoggerStatisticsBlock::SchedulingRefusals, 1);
+        _writer_statistics->endUpdate();
+    }
+
+    _writer_raised = raised;
+#endif
+}
+
+QLogger::route_mask QLogger::route(const Record &record)
+{
+    const int generation = _routes_generation.load();
+    if (generation != _writer_routes_generation) {
+        QMutexLocker locker(&_mutex);
+        _writer_routes              = _routes;
+        _writer_routes_generation   = _routes_generation.load();
+    }
+
+    if (!record.category.isEmpty() && !_writer_routes.categories.isEmpty()) {
+        auto it = _writer_routes.categories.constFind(record.category);
+        if (it != _writer_routes.categories.constEnd())
+            return it.value();
+    }
+
+    return _writer_routes.levels[static_cast<int>(record.level)];
+}
+
+void QLogger::routesChanged()
+{
+    _routes_generation.ref();
+}
+
+QLogger::route_mask QLogger::toMask(const QList<int> &streams)
+{
+    route_mask mask = 0;
+    for (int index : streams) {
+        if (index >= 0 && index < MaxStreams)
+            mask |= route_mask(1) << index;
+    }
+    return mask;
+}
+
+QList<int> QLogger::fromMask(route_mask mask)
+{
+    QList<int> streams;
+    for (int i = 0; i < MaxStreams; ++i) {
+        if (mask & (route_mask(1) << i))
+            streams.append(i);
+    }
+    return streams;
+}
+
+void QLogger::finishWriting()
+{
+    InsideLogger guard;     // the trace below must not come back through the bridge, _mutex is locked
+    QMutexLocker locker(&_mutex);
+    _finish = 1;
+    wakeWriter();       // it could be waiting
+    qDebug() << "QLogger::finishWriting()----->Wake one";
+}
+
+void QLogger::releaseFlush(FlushRequest &request, bool ok)
+{
+    if (!ok)
+        request.failed.store(1);
+
+    if (!request.pending.deref())
+        finishFlush(request, request.failed.load() == 0);
+}
+
+void QLogger::finishFlush(FlushRequest &request, bool ok)
+{
+    request.promise.reportResult(ok);
+    request.promise.reportFinished();
+}
+
+void QLogger::failPendingFlushes()
+{
+    QQueue<Record> messages;
+    for (const Record& record : _messages) {
+        if (record.barrier)
+            finishFlush(*record.barrier, false);
+        else
+            messages.enqueue(record);
+    }
+
+    _messages.swap(messages);
+    _messages_size.store(_messages.size() + _priority_messages.size());
+}
+
+QString QLogger::logLevelToString(const LogLevel &level) const
+{
+    switch (level) {
+    case LogLevel::Info:        return "INFO";
+    case LogLevel::Debug:       return "DEBUG";
+    case LogLevel::Warning:     return "WARNING";
+    case LogLevel::Fatal:       return "FATAL";
+    }
+
+    return "";
+}
+
+QStringList QLogger::messages() const
+{
+    QMutexLocker locker(&_mutex);
+
+    QStringList messages;
+    const auto text = [this](const Record& record) {
+        if (!record.data.isNull())
+            return QString::fromUtf8(record.data);
+        return QString::fromUtf8(formatMessage(record.datetime, record.level, record.category,
+                                               messageBody(record.message, record.utf8), record.fields));
+    };
+
+    for (const Record& record : _priority_messages)
+        messages.append(text(record));
+
+    for (const Record& record : _messages) {
+        if (!record.barrier)
+            messages.append(text(record));
+    }
+    return messages;
+}
+
+QString QLogger::errorString() const
+{
+    // _sinks doesn't change once the logger has started
+    const std::shared_ptr<const QString> error = std::atomic_load(&_error_string);
+    if (!error->isEmpty())
+        return *error;
+
+    for (const Sink& sink : _sinks) {
+        if (sink.writer) {
+            const QString writer_error = sink.writer->errorString();
+            if (!writer_error.isEmpty())
+                return writer_error;
+        }
+    }
+    return QString();
+}
+
+QString QLogger::formatString() const
+{
+    return std::atomic_load(&_format)->format_string;
+}
+
+QString QLogger::datetimeFormat() const
+{
+    return std::atomic_load(&_format)->datetime_format;
+}
+
+void QLogger::setFormatString(const QString &formatString)
+{
+    format_ptr current = std::atomic_load(&_format);
+    format_ptr next;
+    do {
+        next = compileFormat(formatString, current->datetime_format);
+    } while (!std::atomic_compare_exchange_weak(&_format, &current, next));
+}
+
+void QLogger::setDatetimeFormat(const QString &datetimeFormat)
+{
+    format_ptr current = std::atomic_load(&_format);
+    format_ptr next;
+    do {
+        next = compileFormat(current->format_string, datetimeFormat);
+    } while (!std::atomic_compare_exchange_weak(&_format, &current, next));
+}
+
+QLogger::OutputFormat QLogger::outputFormat() const
+{
+    return static_cast<OutputFormat>(_output_format.load());
+}
+
+void QLogger::setOutputFormat(const OutputFormat &format)
+{
+    _output_format.store(static_cast<int>(format));
+}
+
+QLogger::FieldFormat QLogger::fieldFormat() const
+{
+    return static_cast<FieldFormat>(_field_format.load());
+}
+
+void QLogger::setFieldFormat(const FieldFormat &format)
+{
+    _field_format.store(static_cast<int>(format));
+}
+
+QList<int> QLogger::levelRoute(const LogLevel &level) const
+{
+    QMutexLocker locker(&_mutex);
+    const route_mask mask = _routes.levels[static_cast<int>(level)];
+
+    QList<int> streams;
+    for (int index : fromMask(mask)) {
+        if (index < streamCount())
+            streams.append(index);
+    }
+    return streams;
+}
+
+QList<int> QLogger::categoryRoute(const QString &category) const
+{
+    QMutexLocker locker(&_mutex);
+    if (!_routes.categories.contains(category))
+        return QList<int>();
+
+    return fromMask(_routes.categories.value(category));
+}
+
+void QLogger::setLevelRoute(const LogLevel &level, const QList<int> &streams)
+{
+    QMutexLocker locker(&_mutex);
+    _routes.levels[static_cast<int>(level)] = toMask(streams);
+    routesChanged();
+}
+
+void QLogger::setCategoryRoute(const QString &category, const QList<int> &streams)
+{
+    QMutexLocker locker(&_mutex);
+    _routes.categories.insert(category, toMask(streams));
+    routesChanged();
+}
+
+void QLogger::removeCategoryRoute(const QString &category)
+{
+    QMutexLocker locker(&_mutex);
+    _routes.categories.remove(category);
+    routesChanged();
+}
+
+void QLogger::clearRoutes()
+{
+    QMutexLocker locker(&_mutex);
+    for (route_mask& mask : _routes.levels)
+        mask = ~route_mask(0);
+    _routes.categories.clear();
+    routesChanged();
+}
+
+QLogger::LogLevel QLogger::categoryLevel(const QString &category) const
+{
+    return levelOfRank(categoryThreshold(category));
+}
+
+void QLogger::setCategoryLevel(const QString &category, const LogLevel &level)
+{
+    QMutexLocker locker(&_mutex);
+    std::shared_ptr<QHash<QString, int>> levels = _category_levels
+            ? std::make_shared<QHash<QString, int>>(*_category_levels)
+            : std::make_shared<QHash<QString, int>>();
+    levels->insert(category, severityRank(level));
+
+    // published before the generation is bumped, so that a cache is never newer than the levels
+    std::atomic_store(&_category_levels, category_levels_ptr(levels));
+    _category_generation.fetchAndAddOrdered(1);
+}
+
+void QLogger::removeCategoryLevel(const QString &category)
+{
+    QMutexLocker locker(&_mutex);
+    if (!_category_levels || !_category_levels->contains(category))
+        return;
+
+    std::shared_ptr<QHash<QString, int>> levels = std::make_shared<QHash<QString, int>>(*_category_levels);
+    levels->remove(category);
+    std::atomic_store(&_category_levels, levels->isEmpty() ? category_levels_ptr() : category_levels_ptr(levels));
+    _category_generation.fetchAndAddOrdered(1);
+}
+
+int QLogger::categoryThreshold(const QString &category) const
+{
+    const category_levels_ptr levels = std::atomic_load(&_category_levels);
+    return categoryThreshold(levels.get(), category);
+}
+
+int QLogger::categoryThreshold(const QHash<QString, int> *levels, const QString &category)
+{
+    if (!levels)
+        return severityRank(LogLevel::Debug);   // the lowest, everything is enabled
+
+    QString name = category;
+    for (;;) {
+        const auto level = levels->constFind(name);
+        if (level != levels->constEnd())
+            return level.value();
+        if (name.isEmpty())
+            return severityRank(LogLevel::Debug);   // the lowest, everything is enabled
+
+        const int dot = name.lastIndexOf(QLatin1Char('.'));
+        name.truncate(qMax(dot, 0));
+    }
+}
+
+QLoggerCategory::QLoggerCategory(QLogger *logger, const QString &name) :
+    _logger(logger), _name(name)
+{
+    _cache.store(-1);
+}
+
+QLogger::LogLevel QLogger::levelOfRank(int rank)
+{
+    static const LogLevel levels[] = { LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Fatal };
+    return levels[qBound(0, rank, 3)];
+}
+
+int QLoggerCategory::refresh() const
+{
+    // the generation first: the levels read after it are at least as recent
+    const int generation    = _logger->_category_generation.load() & GenerationMask;
+    const int cached        = (generation << GenerationShift) | _logger->categoryThreshold(_name);
+    _cache.store(cached);
+    return cached;
+}
+
+void QLoggerCategory::log(const QString &message, const QLogger::LogLevel &level,
+                          const QLoggerFields &fields) const
+{
+    if (isEnabled(level))
+        _logger->addRecord(message, level, fields, _name, false);
+}
+
+QLoggerRecord QLoggerCategory::record(const QLogger::LogLevel &level) const
+{
+    return QLoggerRecord(isEnabled(level) ? _logger : nullptr, level, _name, false);
+}
+
+QLoggerRecord QLogger::record(const LogLevel &level, const QString &category)
+{
+    return QLoggerRecord(this, level, category, true);
+}
+
+namespace {
+
+/*!
+ *  \brief Formats a double like QString::number(n, 'g', 6), whatever the locale, without allocating
+ *  QCoreApplication sets the locale of the environment, whose decimal point
+ *  may not be '.', so snprintf() runs with the "C" locale on the calling thread.
+ *  \param out where the text goes, NUL terminated
+ *  \param room bytes of out
+ *  \return the length of the text
+ */
+int formatDouble(char* out, int room, double n)
+{
+#if defined(Q_OS_UNIX)
+    static const locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+    const locale_t previous = uselocale(c_locale);
+    const int size = std::snprintf(out, static_cast<size_t>(room), "%g", n);
+    uselocale(previous);
+#elif defined(Q_OS_WIN)
+    static const _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+    const int size = _snprintf_l(out, static_cast<size_t>(room), "%g", c_locale, n);
+#else
+    const QByteArray text = QByteArray::number(n, 'g', 6);
+    const int size = qMin(text.size(), room - 1);
+    memcpy(out, text.constData(), static_cast<size_t>(size));
+#endif
+    return qBound(0, size, room - 1);
+}
+
+}
+
+QLoggerRecord::QLoggerRecord(QLogger *logger, const QLogger::LogLevel &level, const QString &category,
+                             bool filter) :
+    _logger(logger), _level(level), _category(category), _filter(filter),
+    _data(_inline), _size(0), _capacity(InlineSize) {}
+
+QLoggerRecord::QLoggerRecord(QLoggerRecord &&other) :
+    _logger(other._logger), _level(other._level), _category(std::move(other._category)),
+    _filter(other._filter), _fields(std::move(other._fields)),
+    _data(_inline), _size(other._size), _capacity(InlineSize)
+{
+    if (other._heap) {
+        _heap       = std::move(other._heap);
+        _data       = _heap.get();
+        _capacity   = other._capacity;
+    }
+    else {
+        std::memcpy(_inline, other._inline, static_cast<size_t>(_size));
+    }
+
+    other._logger = nullptr;
+}
+
+QLoggerRecord::~QLoggerRecord()
+{
+    commit();
+}
+
+void QLoggerRecord::commit()
+{
+    if (!_logger)
+        return;
+
+    QLogger* const logger = _logger;
+    _logger = nullptr;
+    logger->addRecord(QByteArray(_data, _size), _level, _fields, _category, _filter);
+}
+
+char *QLoggerRecord::grow(int size)
+{
+    if (_size + size > _capacity) {
+        const int capacity = qMax(_capacity * 2, _size + size);
+        std::unique_ptr<char[]> heap(new char[capacity]);
+        std::memcpy(heap.get(), _data, static_cast<size_t>(_size));
+
+        _heap       = std::move(heap);
+        _data       = _heap.get();
+        _capacity   = capacity;
+    }
+    return _data + _size;
+}
+
+void QLoggerRecord::append(const char *data, int size)
+{
+    std::memcpy(grow(size), data, static_cast<size_t>(size));
+    _size += size;
+}
+
+void QLoggerRecord::appendNumber(unsigned long long n, bool negative)
+{
+    static const char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+    char digits[24];
+    char* first = digits + sizeof(digits);
+    while (n >= 100) {
+        const unsigned pair = static_cast<unsigned>(n % 100) * 2;
+        n /= 100;
+        *--first = pairs[pair + 1];
+        *--first = pairs[pair];
+    }
+    if (n >= 10) {
+        *--first = pairs[n * 2 + 1];
+        *--first = pairs[n * 2];
+    }
+    else {
+        *--first = static_cast<char>('0' + n);
+    }
+    if (negative)
+        *--first = '-';
+
+    append(first, static_cast<int>(digits + sizeof(digits) - first));
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(const char *s)
+{
+    if (_logger && s)
+        append(s, static_cast<int>(std::strlen(s)));
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(const QString &s)
+{
+    if (!_logger)
+        return *this;
+
+    // UTF-16 to UTF-8 straight in the buffer, at most 3 bytes per unit
+    char* const first = grow(s.size() * 3);
+    char* out = first;
+    const ushort* in        = s.utf16();
+    const ushort* const end = in + s.size();
+    while (in != end) {
+        uint c = *in++;
+        if (c < 0x80) {
+            *out++ = static_cast<char>(c);
+        }
+        else if (c < 0x800) {
+            *out++ = static_cast<char>(0xc0 | (c >> 6));
+            *out++ = static_cast<char>(0x80 | (c & 0x3f));
+        }
+        else if (QChar::isHighSurrogate(c) && in != end && QChar::isLowSurrogate(*in)) {
+            c = QChar::surrogateToUcs4(static_cast<ushort>(c), *in++);
+            *out++ = static_cast<char>(0xf0 | (c >> 18));
+            *out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (c & 0x3f));
+        }
+        else {
+            if (QChar::isSurrogate(c))
+                c = 0xfffd;     // unpaired, like QString::toUtf8()
+            *out++ = static_cast<char>(0xe0 | (c >> 12));
+            *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (c & 0x3f));
+        }
+    }
+
+    _size += static_cast<int>(out - first);
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(QLatin1String s)
+{
+    if (!_logger)
+        return *this;
+
+    char* const first = grow(s.size() * 2);
+    char* out = first;
+    for (int i = 0; i < s.size(); ++i) {
+        const uchar c = static_cast<uchar>(s.data()[i]);
+        if (c < 0x80) {
+            *out++ = static_cast<char>(c);
+        }
+        else {
+            *out++ = static_cast<char>(0xc0 | (c >> 6));
+            *out++ = static_cast<char>(0x80 | (c & 0x3f));
+        }
+    }
+
+    _size += static_cast<int>(out - first);
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(const QByteArray &s)
+{
+    if (_logger)
+        append(s.constData(), s.size());
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(QChar c)
+{
+    if (!_logger)
+        return *this;
+
+    // a lone surrogate can't be encoded, like QString::toUtf8()
+    const uint u = QChar::isSurrogate(c.unicode()) ? 0xfffd : c.unicode();
+    char* const out = grow(3);
+    int size = 1;
+    if (u < 0x80) {
+        out[0] = static_cast<char>(u);
+    }
+    else if (u < 0x800) {
+        out[0] = static_cast<char>(0xc0 | (u >> 6));
+        out[1] = static_cast<char>(0x80 | (u & 0x3f));
+        size = 2;
+    }
+    else {
+        out[0] = static_cast<char>(0xe0 | (u >> 12));
+        out[1] = static_cast<char>(0x80 | ((u >> 6) & 0x3f));
+        out[2] = static_cast<char>(0x80 | (u & 0x3f));
+        size = 3;
+    }
+
+    _size += size;
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(char c)
+{
+    if (_logger)
+        append(&c, 1);
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(bool b)
+{
+    return *this << (b ? "true" : "false");
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(int n)
+{
+    return *this << static_cast<long long>(n);
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(long n)
+{
+    return *this << static_cast<long long>(n);
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(long long n)
+{
+    if (_logger) {
+        // negated as unsigned, so that the minimum doesn't overflow
+        appendNumber(n < 0 ? 0ull - static_cast<unsigned long long>(n) : static_cast<unsigned long long>(n),
+                     n < 0);
+    }
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(unsigned n)
+{
+    return *this << static_cast<unsigned long long>(n);
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(unsigned long n)
+{
+    return *this << static_cast<unsigned long long>(n);
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(unsigned long long n)
+{
+    if (_logger)
+        appendNumber(n, false);
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(double n)
+{
+    if (_logger) {
+        const int room = 32;    // "%g" takes at most 13 bytes, e.g. -1.23457e-308
+        _size += formatDouble(grow(room), room, n);
+    }
+    return *this;
+}
+
+QLoggerRecord &QLoggerRecord::operator<<(const QLoggerField &field)
+{
+    if (_logger)
+        _fields.append(field);
+    return *this;
+}
+
+QLogger::LogLevel QLogger::priorityLevel() const
+{
+    return levelOfRank(_priority_level.load());
+}
+
+int QLogger::synchronousFatalThreshold() const
+{
+    return _synchronous_threshold.load();
+}
+
+void QLogger::setPriorityLevel(const LogLevel &level)
+{
+    _priority_level.store(severityRank(level));
+}
+
+void QLogger::setSynchronousFatalThreshold(int backlog)
+{
+    _synchronous_threshold.store(backlog);
+}
+
+QList<int> QLogger::writerAffinity() const
+{
+    QMutexLocker locker(&_mutex);
+    return _scheduling.cpus;
+}
+
+QLogger::SchedulingPolicy QLogger::writerSchedulingPolicy() const
+{
+    QMutexLocker locker(&_mutex);
+    return static_cast<SchedulingPolicy>(_scheduling.policy);
+}
+
+int QLogger::writerNice() const
+{
+    QMutexLocker locker(&_mutex);
+    return _scheduling.nice;
+}
+
+int QLogger::adaptivePriorityThreshold() const
+{
+    return _adaptive_threshold.load();
+}
+
+void QLogger::setWriterAffinity(const QList<int> &cpus)
+{
+    QMutexLocker locker(&_mutex);
+    _scheduling.pinned  = true;
+    _scheduling.cpus    = cpus;
+    _scheduling_generation.ref();
+    wakeWriter();   // applied now if the writer is waiting
+}
+
+void QLogger::setWriterScheduling(const SchedulingPolicy &policy, int nice)
+{
+    QMutexLocker locker(&_mutex);
+    _scheduling.policy  = static_cast<int>(policy);
+    _scheduling.nice    = qBound(-20, nice, 19);
+    _scheduling_generation.ref();
+    wakeWriter();
+}
+
+void QLogger::setAdaptivePriority(int backlog, int nice)
+{
+    QMutexLocker locker(&_mutex);
+    _scheduling.raised_nice = qBound(-20, nice, 19);
+    _adaptive_threshold.store(backlog);
+    _scheduling_generation.ref();
+    wakeWriter();
+}
+
+QLogger::LogLevel QLogger::flightRecorderLevel() const
+{
+    QMutexLocker locker(&_mutex);
+    return levelOfRank(_flight_level);
+}
+
+int QLogger::flightRecorderCapacity() const
+{
+    QMutexLocker locker(&_mutex);
+    return _flight_records.size();
+}
+
+void QLogger::setFlightRecorder(const LogLevel &level, int capacity)
+{
+    QMutexLocker locker(&_mutex);
+    dumpFlightRecords(false);   // don't lose what has been recorded so far
+
+    _flight_level   = severityRank(level);
+    _flight_records = QVector<FlightRecord>(qMax(capacity, 0));
+    _flight_next    = 0;
+    _flight_threshold.store(_flight_records.isEmpty() ? severityRank(LogLevel::Debug) : _flight_level);
+}
+
+QLogger::Statistics QLogger::statistics() const
+{
+    Statistics statistics;
+    memset(&statistics, 0, sizeof(statistics));
+
+    // writers first: what they wrote was enqueued before the producers are read
+    _writer_statistics->addTo(statistics);
+    for (const Sink& sink : _sinks) {
+        if (sink.writer)
+            sink.writer->statistics().addTo(statistics);
+    }
+    _producer_statistics->addTo(statistics);
+
+    statistics.queue_size = static_cast<quint64>(_messages_size.load());
+    return statistics;
+}
+
+QLoggerHistogram QLogger::endToEndLatency() const
+{
+    QLoggerHistogram histogram;
+
+    _writer_statistics->addTo(histogram);
+    for (const Sink& sink : _sinks) {
+        if (sink.writer)
+            sink.writer->statistics().addTo(histogram);
+    }
+    return histogram;
+}
+
+int QLogger::latencySummaryInterval() const
+{
+    return qMax(_summary_interval.load(), 0);
+}
+
+void QLogger::setLatencySummaryInterval(int msecs)
+{
+    _summary_interval.store(msecs);
+}
+
+/*!
+ *  \brief Thread of a QLoggerWriterPool
+ */
+class QLoggerWriterPool::Worker : public QThread
+{
+public:
+    explicit Worker(QLoggerWriterPool* pool) : QThread(), _pool(pool) {}
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        _pool->work();
+    }
+
+private:
+    QLoggerWriterPool*  _pool;  //!< the pool it works for
+};
+
+QLoggerWriterPool::QLoggerWriterPool(int threads) : _stop(false)
+{
+    _sleeping.store(0);
+    for (int i = 0; i < qMax(threads, 1); ++i) {
+        _workers.emplace_back(new Worker(this));
+        _workers.back()->start();
+    }
+}
+
+QLoggerWriterPool::~QLoggerWriterPool()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stop = true;
+        _work.wakeAll();
+    }
+
+    for (auto& worker : _workers)
+        worker->wait();
+}
+
+int QLoggerWriterPool::threadCount() const
+{
+    return static_cast<int>(_workers.size());
+}
+
+int QLoggerWriterPool::loggerCount() const
+{
+    QMutexLocker locker(&_mutex);
+    return _entries.size();
+}
+
+bool QLoggerWriterPool::start(QLogger *logger)
+{
+    {
+        QMutexLocker locker(&logger->_mutex);
+        if (logger->isRunning() || logger->_stopped || !logger->_pool.testAndSetOrdered(nullptr, this))
+            return false;   // already writing, or over
+    }
+
+    Entry entry;
+    entry.logger    = logger;
+    entry.busy      = false;
+    entry.opened    = false;
+    entry.skipped   = 0;
+
+    QMutexLocker locker(&_mutex);
+    _entries.append(entry);
+    _work.wakeOne();
+    return true;
+}
+
+bool QLoggerWriterPool::wait(QLogger *logger, unsigned long msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker(&_mutex);
+    forever {
+        bool found = false;
+        for (const Entry& entry : _entries)
+            found = found || entry.logger == logger;
+        if (!found)
+            return true;
+
+        if (msecs == ULONG_MAX) {
+            _done.wait(&_mutex);
+            continue;
+        }
+
+        const qint64 left = static_cast<qint64>(msecs) - timer.elapsed();
+        if (left <= 0)
+            return false;
+        _done.wait(&_mutex, static_cast<unsigned long>(left));
+    }
+}
+
+int QLoggerWriterPool::choose()
+{
+    int best            = -1;
+    qint64 best_weight  = 0;
+    for (int i = 0; i < _entries.size(); ++i) {
+        const Entry& entry = _entries[i];
+        if (entry.busy)
+            continue;
+
+        const int depth = entry.logger->_messages_size.load();
+        qint64 weight   = static_cast<qint64>(depth) << entry.skipped;
+        if (!entry.opened || (depth == 0 && entry.logger->_finish.load()))
+            weight = std::numeric_limits<qint64>::max();    // opening and closing don't wait
+
+        if (weight > best_weight) {
+            best        = i;
+            best_weight = weight;
+        }
+    }
+
+    if (best < 0)
+        return -1;
+
+    // the others waiting weigh twice as much next round
+    for (int i = 0; i < _entries.size(); ++i) {
+        Entry& entry = _entries[i];
+        if (i == best)
+            entry.skipped = 0;
+        else if (!entry.busy && entry.logger->_messages_size.load() != 0)
+            entry.skipped = qMin(entry.skipped + 1, 30);
+    }
+    return best;
+}
+
+bool QLoggerWriterPool::write(QLogger *logger, bool opened)
+{
+    if (!opened && !logger->openStreams())
+        return true;
+
+    // as many as were waiting, so the longer queues get the longer turns
+    int batch = qBound(1, logger->_messages_size.load(), static_cast<int>(MaxBatch));
+    while (batch-- > 0 && logger->writeNext()) {}
+
+    if (logger->_messages_size.load() != 0)
+        return false;
+
+    if (logger->_finish.load()) {
+        logger->closeStreams();
+        return true;
+    }
+
+    logger->drainStreams();
+    logger->syncIdleJournal();
+    return false;
+}
+
+void QLoggerWriterPool::work()
+{
+    InsideLogger guard;
+
+    QMutexLocker locker(&_mutex);
+    forever {
+        int index = choose();
+        if (index < 0) {
+            if (_stop)
+                return;
+
+            // pairs with the fence of wake(): either the logger sees us sleeping
+            // or we see its messages
+            _sleeping.ref();
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            index = choose();
+            if (index < 0)
+                _work.wait(&_mutex);
+            _sleeping.deref();
+
+            if (index < 0)
+                continue;
+        }
+
+        Entry& entry        = _entries[index];
+        QLogger* logger     = entry.logger;
+        const bool opened   = entry.opened;
+        entry.busy          = true;
+        locker.unlock();
+
+        const bool over = write(logger, opened);
+
+        locker.relock();
+        for (int i = 0; i < _entries.size(); ++i) {
+            if (_entries[i].logger != logger)
+                continue;
+
+            if (over) {
+                _entries.remove(i);
+                _done.wakeAll();
+            }
+            else {
+                _entries[i].busy    = false;
+                _entries[i].opened  = true;
+            }
+            break;
+        }
+    }
+}
+
+void QLoggerWriterPool::wake()
+{
+    // the logger stored its queue size before, see work()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load() > 0) {
+        QMutexLocker locker(&_mutex);
+        _work.wakeOne();
+    }
 }
@@ -30,15 +30,26 @@
 #include "qlogger_global.h"
 
 #include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QDateTime>
 
 #include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QQueue>
+
+#include <QFuture>
+#include <QFutureInterface>
 
 #include <QFile>
 #include <QAbstractSocket>
 
+#include <climits>
 #include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 /*! \mainpage QLogger library
  *  This library provides utilities for writing quickly and thread-safetly
@@ -84,6 +95,58 @@ public:
      */
     virtual qint64 write(const QString& s) = 0;
 
+    /*!
+     *  \brief Writes already encoded bytes in the stream
+     *  QLogger formats every message once in UTF-8 and hands the same bytes
+     *  to all of its streams through this function.
+     *  The default implementation decodes data and calls write(),
+     *  streams working on bytes should reimplement it.
+     *  \param data UTF-8 encoded string to write
+     *  \return bytes actually written or -1 if an error occured
+     */
+    virtual qint64 writeData(const QByteArray& data) { return write(QString::fromUtf8(data)); }
+
+    /*!
+     *  \brief Writes a message along with what QLogger knows about it
+     *  This is what QLogger calls, the default implementation ignores the
+     *  metadata and calls writeData(). Streams framing the messages, e.g.
+     *  with their severity, reimplement it.
+     *  \param data UTF-8 formatted message, as given to writeData()
+     *  \param level a QLogger::LogLevel
+     *  \param timestamp when the message was added, milliseconds since the epoch
+     *  \param category category of the message, may be empty
+     *  \return bytes actually written or -1 if an error occured
+     */
+    virtual qint64 writeMessage(const QByteArray& data, int level, qint64 timestamp, const QString& category)
+    {
+        Q_UNUSED(level)
+        Q_UNUSED(timestamp)
+        Q_UNUSED(category)
+        return writeData(data);
+    }
+
+    /*!
+     *  \brief Tells the stream its writer ran out of messages
+     *  Called before the writer waits for more, it's the moment for a stream
+     *  batching its writes to send what it holds. The default does nothing.
+     */
+    virtual void drained() {}
+
+    /*!
+     *  \brief Pushes buffered data down to the underlying device
+     *  The default implementation does nothing, it's meant for buffered streams.
+     *  \return true if successful, otherwise false
+     */
+    virtual bool flush() { return true; }
+
+    /*!
+     *  \brief Returns the native file descriptor of the stream, if any
+     *  QLogger's crash handler writes its emergency dump there.
+     *  \return the file descriptor or -1, which is the default
+     *  \sa QLogger::enableCrashHandler()
+     */
+    virtual int handle() const { return -1; }
+
     /*!
      *  \brief Closes the stream
      */
@@ -132,11 +195,24 @@ public:
      */
     qint64 write(const QString& s) Q_DECL_OVERRIDE;
 
+    /*!
+     *  \brief writes data in the file
+     *  \param data UTF-8 encoded string to write
+     *  \return bytes actually written
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
+
     /*!
      *  \brief flushes the stream
      *  \return true if successful otherwise false
      */
-    bool flush();
+    bool flush() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief getter
+     *  \return the file descriptor of the file or -1 if it isn't open
+     */
+    int handle() const Q_DECL_OVERRIDE;
 
     /*!
      *  \brief closes the stream
@@ -194,12 +270,26 @@ private:
  *  because
  *  <a href= "https://qt-project.org/doc/qt-4.8/qtcpserver.html#nextPendingConnection">n extPendingConnection</a>
  *  doesn't work for sockets in different threads.
+ *  Otherwise qlogger-collector --listen serves any number of clients, writing
+ *  the messages of each one in a file of its own.
+ *  With Framing::LengthPrefixed every message goes in a binary frame carrying
+ *  its level, time and category, see QLoggerFrameDecoder: the receiver reads
+ *  sizes instead of looking for '\n', and messages may span many lines.
  */
 class QLOGGERSHARED_EXPORT QLoggerSocketStream : public QLoggerStream
 {
 public:
     using socket_ptr = std::unique_ptr<QAbstractSocket>;    //!< pointer type for the socket
 
+    /*!
+     *  \brief The Framing enum
+     *  How the messages follow each other on the socket
+     */
+    enum class Framing {
+        Lines,          //!< the formatted messages, each one ends with '\n'
+        LengthPrefixed  //!< a frame per message, see QLoggerFrameDecoder
+    };
+
     /*!
      *  \brief QLoggerSocketStream
      *  Default constructor
@@ -239,6 +329,20 @@ public:
      */
     quint16 port() const;
 
+    /*!
+     *  \brief setter, the receiver must expect the same, so set it before open()
+     *  \param framing
+     *  \sa framing()
+     */
+    void setFraming(Framing framing);
+
+    /*!
+     *  \brief getter
+     *  \return how the messages are sent, Framing::Lines by default
+     *  \sa setFraming()
+     */
+    Framing framing() const;
+
     /*!
      *  \brief getter
      *  \return the socket used in the connection
@@ -269,6 +373,26 @@ public:
      */
     qint64 write(const QString &s) Q_DECL_OVERRIDE;
 
+    /*!
+     *  \brief writes data into the stream, as an Info message added now if framed
+     *  \param data UTF-8 encoded string to write
+     *  \return payload written
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief writes a message into the stream, framed with its metadata if set so
+     *  \return bytes written, frame included, -1 if an error occured
+     */
+    qint64 writeMessage(const QByteArray& data, int level, qint64 timestamp,
+                        const QString& category) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief flushes the socket and waits until its buffer is empty
+     *  \return true if successful otherwise false
+     */
+    bool flush() Q_DECL_OVERRIDE;
+
     /*!
       * \brief closes the stream and waits until socket it's disconnected
       */
@@ -280,219 +404,2528 @@ public:
      */
     QString errorString() const Q_DECL_OVERRIDE;
 private:
+    /*!
+     *  \brief Writes bytes in the socket and waits for them to be sent
+     *  \return bytes written, -1 if an error occured
+     */
+    qint64 send(const QByteArray& bytes);
+
     socket_ptr  _socket;            //!< socket to use, his parent is reset in the constructor to nullptr
 
     QString     _hostname;          //!< hostname the socket will connect to
     quint16     _port;              //!< port the socket will connect to
+    Framing     _framing;           //!< how the messages are sent
+    QByteArray  _frame;             //!< frame being sent, kept to reuse its memory
+    QString     _category;          //!< category of _category_utf8
+    QByteArray  _category_utf8;     //!< last category framed, encoded
 };
 
 /*!
- *  \class QLoggerDebugStream ""
- *  \brief The QLoggerDebugStream class
- *  It's an implementation of QLoggerStream working on qDebug()
+ *  \class QLoggerFrameDecoder ""
+ *  \brief The QLoggerFrameDecoder class
+ *  It splits what a QLoggerSocketStream with Framing::LengthPrefixed sends
+ *  back into messages. A frame is a header of HeaderSize bytes, big endian:
+ *  - 4 bytes, size of the message
+ *  - 1 byte, Version
+ *  - 1 byte, level, a QLogger::LogLevel
+ *  - 2 bytes, size of the category
+ *  - 8 bytes, milliseconds since the epoch the message was added at
+ *
+ *  followed by the category and the message, both UTF-8. The message is the
+ *  formatted one without its final '\n' and it may span many lines, the
+ *  sizes tell where it ends so nothing is scanned.
+ *  Feed it the bytes as they arrive with append() and take the messages with
+ *  next(). A frame making no sense, e.g. of another version or longer than
+ *  the maximum size, is an error and the decoder stops there.
  */
-class QLOGGERSHARED_EXPORT QLoggerDebugStream : public QLoggerStream
+class QLOGGERSHARED_EXPORT QLoggerFrameDecoder
 {
 public:
+    static const int HeaderSize = 16;   //!< bytes of the header of a frame
+    static const int Version    = 1;    //!< version of the frames
+
     /*!
-     *  \brief opens the stream
-     *  \return always true
+     *  \brief A decoded message
      */
-    bool open() Q_DECL_OVERRIDE { return true; }
+    struct Frame {
+        int         level;      //!< a QLogger::LogLevel
+        qint64      timestamp;  //!< when the message was added, milliseconds since the epoch
+        QString     category;   //!< category of the message, may be empty
+        QByteArray  message;    //!< formatted UTF-8 message, without its final '\n'
+    };
 
     /*!
-     *  \brief checks if the stream is open
-     *  \return always true
+     *  \brief QLoggerFrameDecoder
+     *  Default constructor
+     *  \param maxMessageSize bytes of a message, larger ones are an error
      */
-    bool isOpen() const Q_DECL_OVERRIDE { return true; }
+    explicit QLoggerFrameDecoder(int maxMessageSize = 16 << 20);
 
     /*!
-     *  \brief Writes in the stream
-     *  \param s string to write
-     *  \return always 42
+     *  \brief Appends a frame
+     *  \param frame where the frame is appended
+     *  \param message UTF-8 message
+     *  \param level a QLogger::LogLevel
+     *  \param timestamp milliseconds since the epoch
+     *  \param category UTF-8 category, cut at 65535 bytes
      */
-    qint64 write(const QString &s) Q_DECL_OVERRIDE { qDebug() << s; return 42; }
+    static void encode(QByteArray* frame, const QByteArray& message, int level, qint64 timestamp,
+                       const QByteArray& category = QByteArray());
 
     /*!
-     *  \brief Closes the stream
+     *  \brief Appends received bytes
+     *  \param data
+     *  \param size
      */
-    void close() Q_DECL_OVERRIDE {}
+    void append(const char* data, int size);
+
+    /*!
+     *  \brief Appends received bytes
+     *  \param data
+     */
+    void append(const QByteArray& data);
+
+    /*!
+     *  \brief Takes the next message
+     *  \param frame set to the message, if any
+     *  \return false if no frame is complete yet, or after an error
+     */
+    bool next(Frame* frame);
+
+    /*!
+     *  \brief getter
+     *  \return the bytes received and not taken yet by next()
+     */
+    int buffered() const;
 
     /*!
      *  \brief error utility
-     *  \return always ""
+     *  \return true if a frame made no sense
      */
-    QString errorString() const Q_DECL_OVERRIDE { return "";}
+    bool hasError() const;
+
+    /*!
+     *  \brief error utility
+     *  \return the error description, empty if none
+     */
+    QString errorString() const;
+
+    /*!
+     *  \brief Drops what's buffered and the error, to decode a new stream
+     */
+    void clear();
+private:
+    QByteArray  _buffer;        //!< bytes received, from _offset on not decoded yet
+    int         _offset;        //!< start of the next frame in _buffer
+    int         _max_message;   //!< bytes of a message, at most
+    QString     _error;         //!< error, empty if none
 };
 
 /*!
- *  \class QLogger ""
- *  \brief The QLogger class
- *  It's a thread working as a basic logger.
- *  Moreover it's extremely easy to use and it's completely thread-safe.
- *
- *  QLogger can only manage a file set in the constructor and cannot be changed.
- *  After have set filename, just add a message with its level with addMessage().
- *  Finally to terminate properly, first call finishWriting() and then
- *  <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#wait">QThread::wait()</a>
- *  on the thread object.
- *
- *  The format of the log message is [datetime] logLevel message. However it's highly
- *  customizable: just subclass QLogger and then reiplement logLevelToString(), datetimeFormat()
- *  and messageFormat().
- *
- *  To check if an error occured use errorString().
- *
- *  Here it is a basic use of the QLogger class.
- * \code
- *     QLogger logger(QLogger::stream_ptr(new QLoggerFileStream("test.log")));
- *
- *     QString message;
- *     for (int i = 0; i < 10000; ++i)
- *          message += QString::number(i);
- *
- *      logger.addMessage(message, QLogger::LogLevel::Info);
- *      logger.start(QThread::IdlePriority);
- *
- *      logger.addMessage(message, QLogger::LogLevel::Fatal);
- *
- *      logger.finishWriting();
- *      logger.wait();
- *
- *      if (!logger.errorString().isEmpty())
- *          qDebug() << logger.errorString();
- * \endcode
- *
- *  Note: debugging options are by default enabled. To disable them uncomment
- *  a line in the pro file.
- *
+ *  \class QLoggerUnixSocketStream ""
+ *  \brief The QLoggerUnixSocketStream class
+ *  It's an implementation of QLoggerStream sending the messages to a local
+ *  process through an AF_UNIX socket, without the TCP stack nor a Qt event loop.
+ *  With Mode::SeqPacket every message is a packet of its own, so the receiver
+ *  gets one message per recv() and never has to look for the '\n' that still
+ *  ends it; with Mode::Stream messages follow each other as on a TCP socket.
+ *  The socket is blocking: a write returns once the kernel has the whole message.
+ *  A packet can't be longer than the socket send buffer, longer messages fail.
+ *  On Linux a path starting with '@' is in the abstract namespace.
+ *  POSIX only, open() fails elsewhere.
  */
-class QLOGGERSHARED_EXPORT QLogger : public QThread
+class QLOGGERSHARED_EXPORT QLoggerUnixSocketStream : public QLoggerStream
 {
 public:
-    using stream_ptr = std::unique_ptr<QLoggerStream>;      //!< alias for std::unique_ptr<QLoggerStream>
-
     /*!
-     *  \brief The LogLevel enum
-     *  Contains the basic log levels the can be used when logging a message
-     *  \sa addMessage()
+     *  \brief The Mode enum
+     *  The type of the socket
      */
-    enum class LogLevel {
-        Info = 0,       //!< Info message
-        Debug,          //!< Debugging message
-        Warning,        //!< Warning message
-        Fatal           //!< Fatal message, very dangerous
+    enum class Mode {
+        Stream,     //!< SOCK_STREAM, messages are a byte stream
+        SeqPacket   //!< SOCK_SEQPACKET, a message per packet
     };
 
     /*!
-     *  \brief Default constructor
-     *  \param stream the stream to use
-     *  \param parent the parent of the logger if any
+     *  \brief QLoggerUnixSocketStream
+     *  Default constructor
+     *  \param path of the socket the receiver listens on
+     *  \param mode type of the socket
+     *  \sa path(), mode()
      */
-    explicit QLogger(stream_ptr stream, QObject * parent = 0);
+    explicit QLoggerUnixSocketStream(const QString& path = QString(), Mode mode = Mode::SeqPacket);
 
     /*!
-     *  \brief Destructor
-     *  \sa QLogger()
+     *  \brief Destructor, closes the socket
      */
-    virtual ~QLogger();
+    ~QLoggerUnixSocketStream();
+
+    /*!
+     *  \brief connects to the receiver
+     *  \return true if sucessful, otherwise false
+     */
+    bool open() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief open utility
+     *  \return true if connected, otherwise false
+     */
+    bool isOpen() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief sends s encoded in UTF-8
+     *  \param s string to write
+     *  \return bytes written, -1 if an error occured
+     */
+    qint64 write(const QString& s) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief sends data, as a single packet with Mode::SeqPacket
+     *  \param data UTF-8 encoded string to write
+     *  \return bytes written, -1 if an error occured
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
 
     /*!
      *  \brief getter
-     *  \return a reference to the stream
-     *  \sa _stream
+     *  \return the socket descriptor or -1 if it isn't open
+     */
+    int handle() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief closes the socket
+     */
+    void close() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief error utility
+     *  \return the last error description
      */
-    stream_ptr& stream();
+    QString errorString() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief setter, it applies at the next open()
+     *  \param path
+     */
+    void setPath(const QString& path);
 
     /*!
      *  \brief getter
-     *  \return a copy of the messages that have to be written
-     *  \sa addMessage()
+     *  \return the path of the socket
      */
-    QStringList messages() const;
+    QString path() const;
 
     /*!
-     *  \brief To use when checking for errors.
-     *  Use this after the entire work of the QLogger thread.
-     *  \return the description of the last error
+     *  \brief getter
+     *  \return the type of the socket
      */
-    QString errorString() const;
+    Mode mode() const;
+private:
+    QString     _path;      //!< path of the receiver's socket
+    Mode        _mode;      //!< type of the socket
+    int         _fd;        //!< the socket, -1 if closed
+    QString     _error;     //!< last error
+};
+
+/*!
+ *  \class QLoggerSyslogStream ""
+ *  \brief The QLoggerSyslogStream class
+ *  It's an implementation of QLoggerStream sending the messages to a syslog
+ *  server over UDP, a RFC 5424 datagram each:
+ *  <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID - MSG
+ *  PRI combines the facility with the severity of the level, see severity(),
+ *  TIMESTAMP is UTC with milliseconds and MSGID is the category. The header
+ *  already carries the time and the level, setFormatString("%3") keeps them
+ *  out of MSG. The '\n' ending the message is dropped and a datagram longer
+ *  than maxDatagramSize() is cut on a UTF-8 character boundary.
+ *  Datagrams are batched and sent when the writer runs out of messages, when
+ *  BatchSize of them are waiting or on flush(): on Linux with a single
+ *  sendmmsg(), one by one elsewhere. UDP doesn't tell about lost datagrams.
+ *  POSIX only, open() fails elsewhere.
+ */
+class QLOGGERSHARED_EXPORT QLoggerSyslogStream : public QLoggerStream
+{
+public:
+    static const int BatchSize = 64;    //!< datagrams sent at once, at most
 
     /*!
-     *  \brief Returns the format for the message
-     *  This must return a string in arg form, e.g.("[%1] %2 %3") that represents
-     *  the format for the messages. Note that by %1 is datetime, %2 is the log level
-     *  and %3 is the message body.
-     *  \return the format of the message
-     *  \sa logLevelToString(), datetimeFormat()
+     *  \brief The Facility enum
+     *  The syslog facilities of RFC 5424
      */
-    QString formatString() const;
+    enum class Facility {
+        Kernel = 0,     //!< kernel messages
+        User,           //!< user-level messages
+        Mail,           //!< mail system
+        Daemon,         //!< system daemons
+        Auth,           //!< security/authorization messages
+        Syslog,         //!< messages generated internally by syslogd
+        Lpr,            //!< line printer subsystem
+        News,           //!< network news subsystem
+        Uucp,           //!< UUCP subsystem
+        Cron,           //!< clock daemon
+        AuthPriv,       //!< security/authorization messages
+        Ftp,            //!< FTP daemon
+        Local0 = 16,    //!< local use 0
+        Local1,         //!< local use 1
+        Local2,         //!< local use 2
+        Local3,         //!< local use 3
+        Local4,         //!< local use 4
+        Local5,         //!< local use 5
+        Local6,         //!< local use 6
+        Local7          //!< local use 7
+    };
 
     /*!
-     *  \brief Returns the datetime format to be used.
-     *  It can be reimplemented by subclasses.
-     *  \return the string containg the datetime format
+     *  \brief QLoggerSyslogStream
+     *  Default constructor
+     *  \param host name or address of the syslog server
+     *  \param port UDP port of the syslog server
+     *  \param facility of every message
+     *  \sa host(), port(), facility()
      */
-    QString datetimeFormat() const;
-public slots:
+    explicit QLoggerSyslogStream(const QString& host = "127.0.0.1", quint16 port = 514,
+                                 Facility facility = Facility::User);
+
     /*!
-     *  \brief Adds a message to the list
-     *  \param message
-     *  \param level
-     *  \sa messages()
+     *  \brief Destructor, sends what's batched and closes the socket
      */
-    void addMessage(const QString& message, const LogLevel& level);
+    ~QLoggerSyslogStream();
 
     /*!
-     *  \brief Tells the thread to finish writing its messages and
-     *          then to terminate.
-     *  This function should be always used before calling
-     *  <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#wait">QThread::wait()</a>
-     *  in order
-     *  to wait the logger until it has finished
+     *  \brief resolves the server and connects the socket to it
+     *  \return true if sucessful, otherwise false
      */
-    void finishWriting();
+    bool open() Q_DECL_OVERRIDE;
 
     /*!
-     *  \brief setFormatString
-     *  \param formatString
-     *  \sa formatString()
+     *  \brief open utility
+     *  \return true if the socket is open, otherwise false
      */
-    void setFormatString(const QString& formatString);
+    bool isOpen() const Q_DECL_OVERRIDE;
 
     /*!
-     *  \brief setDatetimeFormat
-     *  \param datetimeFormat
-     *  \sa datetimeFormat()
+     *  \brief batches s as an Info message added now
+     *  \param s string to write
+     *  \return bytes of the datagram, -1 if an error occured
      */
-    void setDatetimeFormat(const QString& datetimeFormat);
-protected:
+    qint64 write(const QString& s) Q_DECL_OVERRIDE;
+
     /*!
-      * \brief Run method reimplemented from <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#run">run()</a>
-      */
-    void run() Q_DECL_OVERRIDE;
+     *  \brief batches data as an Info message added now
+     *  \param data UTF-8 encoded string to write
+     *  \return bytes of the datagram, -1 if an error occured
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
 
     /*!
-     *  \brief Transform a log level in a readable format
-     *  It can be reimplemented by subclasses.
-     *  \param level log level to translate
-     *  \return the formatted string
+     *  \brief batches a datagram, sending the batch if full
+     *  \return bytes of the datagram, -1 if it or the last batch sent failed
      */
-    virtual QString logLevelToString(const LogLevel& level) const;
-private:
-    stream_ptr          _stream;        /*!< stream to use for writing the messages \sa _messages */
-    QStringList         _messages;      /*!< messages to write \sa messages(), addMessage() */
+    qint64 writeMessage(const QByteArray& data, int level, qint64 timestamp,
+                        const QString& category) Q_DECL_OVERRIDE;
 
-    mutable QMutex      _mutex;         //!< mutex to synchronize threads
-    QWaitCondition      _empty;         //!< allows to wait while there aren't messages to be written
-    QAtomicInt          _finish;        //! if set to true, it tells that when the thread will have written all the messages,
-                                        //! then it will stop
-    QAtomicInt          _messages_size; //!< atomic int to ensure thread-safety. It's equal of _messages.size()
+    /*!
+     *  \brief sends the batch
+     */
+    void drained() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief sends the batch
+     *  \return true if every datagram was sent, otherwise false
+     */
+    bool flush() Q_DECL_OVERRIDE;
 
-    QString             _error_string;  //!< description of the last error
+    /*!
+     *  \brief sends the batch and closes the socket
+     */
+    void close() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief error utility
+     *  \return the last error description
+     */
+    QString errorString() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief setter, it applies at the next open()
+     *  \param host
+     *  \param port
+     */
+    void setHost(const QString& host, quint16 port = 514);
+
+    /*!
+     *  \brief getter
+     *  \return the syslog server
+     */
+    QString host() const;
+
+    /*!
+     *  \brief getter
+     *  \return the UDP port of the syslog server
+     */
+    quint16 port() const;
+
+    /*!
+     *  \brief setter
+     *  \param facility
+     */
+    void setFacility(Facility facility);
+
+    /*!
+     *  \brief getter
+     *  \return the facility of the messages
+     */
+    Facility facility() const;
+
+    /*!
+     *  \brief setter, it applies at the next open()
+     *  \param name APP-NAME of the messages, the application name if empty
+     */
+    void setAppName(const QString& name);
+
+    /*!
+     *  \brief getter
+     *  \return the APP-NAME set, empty if it's the application name
+     */
+    QString appName() const;
+
+    /*!
+     *  \brief setter, longer datagrams are truncated
+     *  \param bytes between 480 and 65507, 2048 by default as RFC 5424 suggests
+     */
+    void setMaxDatagramSize(int bytes);
+
+    /*!
+     *  \brief getter
+     *  \return the maximum size of a datagram in bytes
+     */
+    int maxDatagramSize() const;
+
+    /*!
+     *  \brief getter
+     *  \return the number of messages truncated so far
+     */
+    quint64 truncated() const;
+
+    /*!
+     *  \brief Maps a level to a syslog severity
+     *  Fatal is critical (2), Warning is warning (4), Info is informational (6)
+     *  and Debug is debug (7).
+     *  \param level a QLogger::LogLevel
+     *  \return the severity
+     */
+    static int severity(int level);
+private:
+    /*!
+     *  \brief Builds the "<PRI>1 " prefix of every severity for _facility
+     */
+    void buildPrefixes();
+
+    /*!
+     *  \brief Sends the datagrams of _batch
+     *  A datagram refused doesn't hold back the others.
+     *  \return true if all of them were sent, otherwise false
+     */
+    bool send();
+
+    QString             _host;          //!< syslog server
+    quint16             _port;          //!< UDP port of the server
+    Facility            _facility;      //!< facility of the messages
+    QByteArray          _prefixes[8];   //!< "<PRI>1 " of each severity, built by buildPrefixes()
+    QString             _app_name;      //!< APP-NAME set, empty for the application name
+    int                 _max_datagram;  //!< bytes of a datagram, at most
+    int                 _fd;            //!< the socket, -1 if closed
+    QByteArray          _fields;        //!< " HOSTNAME APP-NAME PROCID ", built by open()
+    qint64              _second;        //!< second of _time, -1 if none
+    QByteArray          _time;          //!< TIMESTAMP up to the seconds included
+    QString             _category;      //!< category of _msgid
+    QByteArray          _msgid;         //!< MSGID of the last category
+    QByteArray          _batch;         //!< datagrams waiting, back to back
+    std::vector<int>    _ends;          //!< end of each datagram in _batch
+    bool                _failed;        //!< a batch sent by drained() failed, the next write reports it
+    quint64             _truncated;     //!< messages truncated
+    QString             _error;         //!< last error
+};
+
+/*!
+ *  \class QLoggerDebugStream ""
+ *  \brief The QLoggerDebugStream class
+ *  It's an implementation of QLoggerStream working on qDebug()
+ */
+class QLOGGERSHARED_EXPORT QLoggerDebugStream : public QLoggerStream
+{
+public:
+    /*!
+     *  \brief opens the stream
+     *  \return always true
+     */
+    bool open() Q_DECL_OVERRIDE { return true; }
+
+    /*!
+     *  \brief checks if the stream is open
+     *  \return always true
+     */
+    bool isOpen() const Q_DECL_OVERRIDE { return true; }
+
+    /*!
+     *  \brief Writes in the stream
+     *  \param s string to write
+     *  \return always 42
+     */
+    qint64 write(const QString &s) Q_DECL_OVERRIDE { qDebug() << s; return 42; }
+
+    /*!
+     *  \brief Closes the stream
+     */
+    void close() Q_DECL_OVERRIDE {}
+
+    /*!
+     *  \brief error utility
+     *  \return always ""
+     */
+    QString errorString() const Q_DECL_OVERRIDE { return "";}
+};
+
+/*!
+ *  \class QLoggerNullStream ""
+ *  \brief The QLoggerNullStream class
+ *  It's an implementation of QLoggerStream discarding everything while counting
+ *  the bytes, useful to measure the overhead of QLogger alone.
+ */
+class QLOGGERSHARED_EXPORT QLoggerNullStream : public QLoggerStream
+{
+public:
+    /*!
+     *  \brief Default constructor
+     */
+    QLoggerNullStream() : QLoggerStream(), _bytes(0), _writes(0) {}
+
+    /*!
+     *  \brief opens the stream
+     *  \return always true
+     */
+    bool open() Q_DECL_OVERRIDE { return true; }
+
+    /*!
+     *  \brief checks if the stream is open
+     *  \return always true
+     */
+    bool isOpen() const Q_DECL_OVERRIDE { return true; }
+
+    /*!
+     *  \brief counts the UTF-8 bytes of s and discards them
+     *  \param s string to write
+     *  \return bytes "written"
+     */
+    qint64 write(const QString &s) Q_DECL_OVERRIDE { return writeData(s.toUtf8()); }
+
+    /*!
+     *  \brief counts the bytes of data and discards them
+     *  \param data to write
+     *  \return bytes "written"
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE
+    {
+        _bytes.fetchAndAddRelaxed(data.size());
+        _writes.fetchAndAddRelaxed(1);
+        return data.size();
+    }
+
+    /*!
+     *  \brief Closes the stream
+     */
+    void close() Q_DECL_OVERRIDE {}
+
+    /*!
+     *  \brief error utility
+     *  \return always ""
+     */
+    QString errorString() const Q_DECL_OVERRIDE { return ""; }
+
+    /*!
+     *  \brief getter, it can be called from any thread
+     *  \return the bytes written so far
+     */
+    qint64 bytesWritten() const { return _bytes.load(); }
+
+    /*!
+     *  \brief getter, it can be called from any thread
+     *  \return the number of writes so far
+     */
+    qint64 writeCount() const { return _writes.load(); }
+private:
+    QAtomicInteger<qint64>  _bytes;     //!< bytes written
+    QAtomicInteger<qint64>  _writes;    //!< calls to write() and writeData()
+};
+
+/*!
+ *  \class QLoggerMemoryStream ""
+ *  \brief The QLoggerMemoryStream class
+ *  It's an implementation of QLoggerStream appending to a buffer in memory,
+ *  allocated once in the constructor as long as it isn't outgrown.
+ *  It's meant for benchmarks and for tests checking the exact output without
+ *  touching the disk: data() can be called from any thread, e.g. after
+ *  QLogger::flush() has finished.
+ */
+class QLOGGERSHARED_EXPORT QLoggerMemoryStream : public QLoggerStream
+{
+public:
+    /*!
+     *  \brief QLoggerMemoryStream
+     *  Default constructor
+     *  \param capacity bytes preallocated
+     */
+    explicit QLoggerMemoryStream(int capacity = 1 << 20);
+
+    /*!
+     *  \brief opens the stream
+     *  \return always true
+     */
+    bool open() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief checks if the stream is open
+     *  \return true if open, otherwise false
+     */
+    bool isOpen() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief appends s encoded in UTF-8
+     *  \param s string to write
+     *  \return bytes written
+     */
+    qint64 write(const QString &s) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief appends data
+     *  \param data to write
+     *  \return bytes written
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief closes the stream, the data is kept
+     */
+    void close() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief error utility
+     *  \return always ""
+     */
+    QString errorString() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief getter
+     *  \return a copy of everything written so far
+     */
+    QByteArray data() const;
+
+    /*!
+     *  \brief Forgets everything written so far, keeping the buffer allocated
+     */
+    void clear();
+private:
+    mutable QMutex  _mutex;     //!< protects _data, the writer and the readers are different threads
+    QByteArray      _data;      //!< what has been written
+    bool            _open;      //!< whether the stream is open
+};
+
+/*!
+ *  \class QLoggerSharedMemoryStream ""
+ *  \brief The QLoggerSharedMemoryStream class
+ *  It's an implementation of QLoggerStream copying the messages in a ring in
+ *  POSIX shared memory, read by another process, e.g. qlogger-collector, which
+ *  does the actual I/O. A write is a memcpy and an atomic store: the logger
+ *  never waits for the disk and what's in the ring survives a crash of the process.
+ *
+ *  The segment is created by open() if needed and reused if it has the same
+ *  capacity, so a restarted process appends after what the reader hasn't read
+ *  yet. It's never removed by the stream: the reader removes it once drained
+ *  and the writing process gone. A segment has a single writing process
+ *  at a time, open() fails if another live process writes it, before
+ *  resizing or resetting anything. While a reader removes the segment
+ *  open() retries until the name leads to a new one.
+ *  When the ring is full the message is dropped, writeData() returns -1 and
+ *  the drop is counted in the segment for the reader to report.
+ *  POSIX only, open() fails elsewhere.
+ *  \sa QLoggerSharedMemoryReader
+ */
+class QLOGGERSHARED_EXPORT QLoggerSharedMemoryStream : public QLoggerStream
+{
+public:
+    /*!
+     *  \brief QLoggerSharedMemoryStream
+     *  Default constructor
+     *  \param name of the segment, e.g. "/qlogger-server", the leading '/' is added if missing
+     *  \param capacity bytes of the ring, rounded up to a power of 2, at least 4096
+     */
+    explicit QLoggerSharedMemoryStream(const QString& name, int capacity = 4 << 20);
+
+    /*!
+     *  \brief Destructor, closes the stream
+     */
+    ~QLoggerSharedMemoryStream();
+
+    /*!
+     *  \brief creates or reuses the segment and maps it
+     *  \return true if sucessful, otherwise false
+     */
+    bool open() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief open utility
+     *  \return true if the segment is mapped, otherwise false
+     */
+    bool isOpen() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief writes s encoded in UTF-8 in the ring
+     *  \param s string to write
+     *  \return bytes written, -1 if the ring is full
+     */
+    qint64 write(const QString& s) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief writes data in the ring
+     *  \param data UTF-8 encoded string to write, at most half the capacity
+     *  \return bytes written, -1 if the ring is full
+     */
+    qint64 writeData(const QByteArray& data) Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief unmaps the segment, which stays for the reader
+     */
+    void close() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief error utility
+     *  \return the last error description
+     */
+    QString errorString() const Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief getter
+     *  \return the name of the segment
+     */
+    QString name() const;
+
+    /*!
+     *  \brief getter
+     *  \return the capacity of the ring in bytes
+     */
+    int capacity() const;
+private:
+    static const int RemoveRetries = 100;   //!< attempts of open(), 1 ms apart, while a reader removes the segment
+
+    /*!
+     *  \brief open utility, creates or reuses the segment and claims it once
+     *  \param removing set if a reader is removing the segment, open() tries again then
+     *  \return true if sucessful, otherwise false
+     */
+    bool attach(bool* removing);
+
+    QString     _name;      //!< name of the segment, with the leading '/'
+    quint64     _capacity;  //!< bytes of the ring, a power of 2
+    void*       _mapping;   //!< the mapped segment, null if closed
+    quint64     _head;      //!< copy of the head of the ring, the stream is its only writer
+    QString     _error;     //!< last error
+};
+
+/*!
+ *  \class QLoggerSharedMemoryReader ""
+ *  \brief The QLoggerSharedMemoryReader class
+ *  It reads the messages a QLoggerSharedMemoryStream writes in a segment,
+ *  from another process. There must be a single reader per segment.
+ *  \sa QLoggerSharedMemoryStream
+ */
+class QLOGGERSHARED_EXPORT QLoggerSharedMemoryReader
+{
+public:
+    /*!
+     *  \brief Constructor
+     *  \param name of the segment, the leading '/' is added if missing
+     */
+    explicit QLoggerSharedMemoryReader(const QString& name);
+
+    /*!
+     *  \brief Destructor, unmaps the segment
+     */
+    ~QLoggerSharedMemoryReader();
+
+    QLoggerSharedMemoryReader(const QLoggerSharedMemoryReader&) = delete;
+    QLoggerSharedMemoryReader& operator=(const QLoggerSharedMemoryReader&) = delete;
+
+    /*!
+     *  \brief Maps the segment
+     *  \return false if it doesn't exist or the stream hasn't initialized it yet
+     */
+    bool open();
+
+    /*!
+     *  \brief open utility
+     *  \return true if the segment is mapped
+     */
+    bool isOpen() const;
+
+    /*!
+     *  \brief Unmaps the segment
+     */
+    void close();
+
+    /*!
+     *  \brief Appends the messages waiting in the ring to out and frees their room
+     *  If the stream reset the segment with another capacity the segment is
+     *  mapped again, errorString() says so and nothing is read this time.
+     *  \param out where the messages are appended, as they were written
+     *  \param maxBytes no more messages are appended past this size of out, one is always taken
+     *  \return the number of messages read
+     */
+    int read(QByteArray& out, int maxBytes = 1 << 20);
+
+    /*!
+     *  \brief getter
+     *  \return true if there is nothing to read
+     */
+    bool isEmpty() const;
+
+    /*!
+     *  \brief getter
+     *  \return the number of messages the stream dropped because the ring was full
+     */
+    quint64 dropped() const;
+
+    /*!
+     *  \brief Checks if the writing process closed the stream or died
+     *  \return true if nothing more is going to be written
+     */
+    bool isAbandoned() const;
+
+    /*!
+     *  \brief Removes the segment, the mapping stays valid until close()
+     *  The segment is first claimed, so that no stream takes it over between
+     *  the check of isAbandoned() and the removal, and it's removed only if
+     *  its name still leads to the mapped segment.
+     *  \return true if successful, false if not open, taken over or replaced
+     */
+    bool remove();
+
+    /*!
+     *  \brief getter
+     *  \return the name of the segment
+     */
+    QString name() const;
+
+    /*!
+     *  \brief error utility
+     *  \return the last error description
+     */
+    QString errorString() const;
+private:
+    QString     _name;      //!< name of the segment, with the leading '/'
+    void*       _mapping;   //!< the mapped segment, null if closed
+    quint64     _size;      //!< bytes mapped
+    quint64     _device;    //!< device of the mapped segment, to recognize it by name
+    quint64     _inode;     //!< inode of the mapped segment, to recognize it by name
+    QString     _error;     //!< last error
+};
+
+/*!
+ *  \class QLoggerField ""
+ *  \brief The QLoggerField class
+ *  It's a typed key-value pair attached to a message, e.g. QLoggerField("bytes", 512).
+ *  The value keeps its type until the message is formatted, by the writer
+ *  thread, as QLogger::fieldFormat() says.
+ *  Keys are meant to be identifiers: they are written as they are by
+ *  QLogger::FieldFormat::KeyValue.
+ *  \sa QLogger::addMessage()
+ */
+class QLOGGERSHARED_EXPORT QLoggerField
+{
+public:
+    /*!
+     *  \brief The Type enum
+     *  The type of the value of a field
+     */
+    enum class Type {
+        Bool,       //!< bool
+        Int,        //!< signed integer, stored as qint64
+        UInt,       //!< unsigned integer, stored as quint64
+        Double,     //!< floating point number
+        String      //!< string
+    };
+
+    QLoggerField(const QString& key, bool value);               //!< Bool field
+    QLoggerField(const QString& key, int value);                //!< Int field
+    QLoggerField(const QString& key, long value);               //!< Int field
+    QLoggerField(const QString& key, qint64 value);             //!< Int field
+    QLoggerField(const QString& key, uint value);               //!< UInt field
+    QLoggerField(const QString& key, unsigned long value);      //!< UInt field
+    QLoggerField(const QString& key, quint64 value);            //!< UInt field
+    QLoggerField(const QString& key, double value);             //!< Double field
+    QLoggerField(const QString& key, const QString& value);     //!< String field
+    QLoggerField(const QString& key, const char* value);        //!< String field, value is UTF-8
+
+    /*!
+     *  \brief getter
+     *  \return the key of the field
+     */
+    const QString& key() const { return _key; }
+
+    /*!
+     *  \brief getter
+     *  \return the type of the value
+     */
+    Type type() const { return _type; }
+
+    bool    boolValue() const   { return _value.b; }    //!< the value of a Bool field
+    qint64  intValue() const    { return _value.i; }    //!< the value of an Int field
+    quint64 uintValue() const   { return _value.u; }    //!< the value of a UInt field
+    double  doubleValue() const { return _value.d; }    //!< the value of a Double field
+
+    /*!
+     *  \brief getter
+     *  \return the value of a String field, empty for the other types
+     */
+    const QString& stringValue() const { return _string; }
+private:
+    QString     _key;       //!< name of the field
+    Type        _type;      //!< which member of _value, or _string, holds the value
+    union {
+        bool    b;
+        qint64  i;
+        quint64 u;
+        double  d;
+    }           _value;     //!< value of the non-string types
+    QString     _string;    //!< value of String fields
+};
+
+using QLoggerFields = QVector<QLoggerField>;    //!< fields of a message, in order
+
+/*!
+ *  \class QLoggerJson ""
+ *  \brief The QLoggerJson class
+ *  It's the JSON string encoder of QLogger::OutputFormat::JsonLines.
+ *  It works on UTF-8 bytes and copies the runs of bytes needing no escape
+ *  at once: they are found 32 bytes at a time with AVX2 when the CPU has it,
+ *  16 at a time with SSE2 otherwise, and one at a time on other architectures.
+ */
+class QLOGGERSHARED_EXPORT QLoggerJson
+{
+public:
+    /*!
+     *  \brief Looks for the first byte that must be escaped in a JSON string
+     *  Those are the control characters, '"' and '\\'.
+     *  \param data UTF-8 encoded string
+     *  \param size of data in bytes
+     *  \return the index of the byte, size if there's none
+     */
+    static int findEscape(const char* data, int size);
+
+    /*!
+     *  \brief Appends a string to out as a JSON string, quotes included
+     *  \param out where the string is appended
+     *  \param data UTF-8 encoded string
+     *  \param size of data in bytes
+     */
+    static void appendString(QByteArray& out, const char* data, int size);
+
+    /*!
+     *  \brief Appends a string to out as a JSON string, quotes included
+     *  \param out where the string is appended
+     *  \param s the string
+     */
+    static void appendString(QByteArray& out, const QString& s);
+};
+
+/*!
+ *  \class QLoggerHistogram ""
+ *  \brief The QLoggerHistogram class
+ *  It's a log-bucketed histogram of durations in nanoseconds, in the style of
+ *  HdrHistogram: each power of 2 is split in SubBuckets linear buckets, so any
+ *  value is known within about 6% while the size stays fixed.
+ *  \sa QLogger::endToEndLatency()
+ */
+class QLOGGERSHARED_EXPORT QLoggerHistogram
+{
+public:
+    static const int SubBuckets     = 16;                       //!< linear buckets per power of 2
+    static const int BucketCount    = (63 - 3) * SubBuckets;    //!< buckets needed for any positive qint64
+
+    /*!
+     *  \brief Default constructor, the histogram is empty
+     */
+    QLoggerHistogram();
+
+    /*!
+     *  \brief Adds a value
+     *  \param nsecs value to add, negative values count as 0
+     */
+    void record(qint64 nsecs);
+
+    /*!
+     *  \brief Adds count values in a bucket, used to rebuild a histogram from raw counters
+     *  \param bucket index of the bucket
+     *  \param count values to add
+     */
+    void addToBucket(int bucket, quint64 count);
+
+    /*!
+     *  \brief Adds all the values of other
+     *  \param other
+     */
+    void merge(const QLoggerHistogram& other);
+
+    /*!
+     *  \brief getter
+     *  \return the number of values recorded
+     */
+    quint64 count() const;
+
+    /*!
+     *  \brief getter
+     *  \return the lowest value recorded, with the bucket precision, 0 if empty
+     */
+    qint64 min() const;
+
+    /*!
+     *  \brief getter
+     *  \return the highest value recorded, with the bucket precision, 0 if empty
+     */
+    qint64 max() const;
+
+    /*!
+     *  \brief getter
+     *  \return the mean of the values, with the bucket precision, 0 if empty
+     */
+    double mean() const;
+
+    /*!
+     *  \brief Returns the value below which a percentage of the values fall
+     *  \param percentile between 0 and 100, e.g. 99.9
+     *  \return the highest value of the bucket holding the percentile, 0 if empty
+     */
+    qint64 percentile(double percentile) const;
+
+    /*!
+     *  \brief Returns a one line description, e.g. "count=10 p50=12us p90=40us p99=... max=..."
+     *  \return the description
+     */
+    QString summary() const;
+
+    /*!
+     *  \brief Maps a value to its bucket
+     *  \param nsecs the value, it must not be negative
+     *  \return the index of the bucket
+     */
+    static int bucketOf(qint64 nsecs);
+
+    /*!
+     *  \brief getter
+     *  \param bucket index of the bucket
+     *  \return the lowest value falling in bucket
+     */
+    static qint64 lowerBound(int bucket);
+
+    /*!
+     *  \brief getter
+     *  \param bucket index of the bucket
+     *  \return the highest value falling in bucket
+     */
+    static qint64 upperBound(int bucket);
+private:
+    QVector<quint64>    _counts;    //!< values per bucket
+    quint64             _count;     //!< sum of _counts
+};
+
+class QLoggerCrashJournal;
+class QLoggerStatisticsBlock;
+class QLoggerCategory;
+class QLoggerRecord;
+class QLoggerWriterPool;
+
+/*!
+ *  \class QLogger ""
+ *  \brief The QLogger class
+ *  It's a thread working as a basic logger.
+ *  Moreover it's extremely easy to use and it's completely thread-safe.
+ *
+ *  QLogger writes to the stream set in the constructor and to the ones added
+ *  with addStream() before starting it: each message is formatted once and the
+ *  same bytes are dispatched to every stream whose level accepts it.
+ *  Streams added as threaded are written by a thread of their own, so a slow
+ *  socket doesn't hold back a file.
+ *  Which streams get a message can be restricted per level and per category
+ *  with setLevelRoute() and setCategoryRoute().
+ *
+ *  Messages from priorityLevel() up skip the queue of the ordinary ones, and a
+ *  Fatal message can even be written by the calling thread when the backlog is
+ *  too long, see setSynchronousFatalThreshold().
+ *
+ *  On Unix enableCrashHandler() makes the messages not yet flushed survive a crash.
+ *
+ *  Low level messages can be kept in memory only, by a flight recorder
+ *  dumped on demand or when a Fatal message comes, see setFlightRecorder().
+ *
+ *  statistics() tells how the logger is doing without slowing it down, and
+ *  endToEndLatency() how long messages wait between addMessage() and their write.
+ *  Just add a message with its level with addMessage().
+ *  Finally to terminate properly, first call finishWriting() and then
+ *  <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#wait">QThread::wait()</a>
+ *  on the thread object.
+ *
+ *  The format of the log message is [datetime] logLevel message. However it's highly
+ *  customizable: just subclass QLogger and then reiplement logLevelToString(), datetimeFormat()
+ *  and messageFormat().
+ *
+ *  To check if an error occured use errorString().
+ *
+ *  Don't start the logger with QThread::IdlePriority: under load the writer
+ *  gets no CPU and the queue grows without bound. On Linux setWriterAffinity(),
+ *  setWriterScheduling() and setAdaptivePriority() control where and how
+ *  the writer thread runs.
+ *
+ *  To wait until the messages added so far have reached the stream without stopping
+ *  the logger use flush(), it returns a
+ *  <a href = "http://qt-project.org/doc/qt-5/qfuture.html">QFuture</a>
+ *  that finishes when the writer thread gets there.
+ *
+ *  Here it is a basic use of the QLogger class.
+ * \code
+ *     QLogger logger(QLogger::stream_ptr(new QLoggerFileStream("test.log")));
+ *
+ *     QString message;
+ *     for (int i = 0; i < 10000; ++i)
+ *          message += QString::number(i);
+ *
+ *      logger.addMessage(message, QLogger::LogLevel::Info);
+ *      logger.setWriterScheduling(QLogger::SchedulingPolicy::Batch);
+ *      logger.setAdaptivePriority(10000);
+ *      logger.start();
+ *
+ *      logger.addMessage(message, QLogger::LogLevel::Fatal);
+ *      logger.flush(true).waitForFinished();
+ *
+ *      logger.finishWriting();
+ *      logger.wait();
+ *
+ *      if (!logger.errorString().isEmpty())
+ *          qDebug() << logger.errorString();
+ * \endcode
+ *
+ *  Note: debugging options are by default enabled. To disable them uncomment
+ *  a line in the pro file.
+ *
+ */
+class QLOGGERSHARED_EXPORT QLogger : public QThread
+{
+public:
+    using stream_ptr = std::unique_ptr<QLoggerStream>;      //!< alias for std::unique_ptr<QLoggerStream>
+
+    /*!
+     *  \brief The LogLevel enum
+     *  Contains the basic log levels the can be used when logging a message
+     *  \sa addMessage()
+     */
+    enum class LogLevel {
+        Info = 0,       //!< Info message
+        Debug,          //!< Debugging message
+        Warning,        //!< Warning message
+        Fatal           //!< Fatal message, very dangerous
+    };
+
+    /*!
+     *  \brief Orders the levels by severity: Debug < Info < Warning < Fatal
+     *  The values of LogLevel keep Info first for compatibility, every level
+     *  threshold compares ranks instead.
+     *  \param level
+     *  \return 0 for Debug, 1 for Info, 2 for Warning, 3 for Fatal
+     */
+    static int severityRank(const LogLevel& level)
+    {
+        return level == LogLevel::Debug ? 0 : level == LogLevel::Info ? 1 : static_cast<int>(level);
+    }
+
+    /*!
+     *  \brief The FieldFormat enum
+     *  How the fields of a message are appended to its body
+     *  \sa setFieldFormat(), QLoggerField
+     */
+    enum class FieldFormat {
+        KeyValue = 0,   //!< logfmt style: key=value, strings quoted when needed, e.g. peer="a b" bytes=512
+        Json            //!< a JSON object, e.g. {"peer":"a b","bytes":512}
+    };
+
+    /*!
+     *  \brief The OutputFormat enum
+     *  How the messages are written
+     *  \sa setOutputFormat()
+     */
+    enum class OutputFormat {
+        Text = 0,       //!< formatString() with the fields appended to the body as fieldFormat() says
+        JsonLines       /*!< a JSON object per line: {"ts":...,"level":...,"msg":...}, then
+                             "category" if any and the fields as members of their own */
+    };
+
+    /*!
+     *  \brief The SchedulingPolicy enum
+     *  Scheduling policy of the writer thread, Linux only
+     *  \sa setWriterScheduling()
+     */
+    enum class SchedulingPolicy {
+        Inherit = 0,    //!< the one given by start(), the nice value isn't changed either
+        Normal,         //!< SCHED_OTHER
+        Batch           //!< SCHED_BATCH, for a writer caring about throughput rather than latency
+    };
+
+    /*!
+     *  \brief Tag of the addMessage() overload calling the callable on the writer thread
+     */
+    struct WriterThread {};
+
+    static const int MaxStreams = 32;   //!< maximum number of streams \sa addStream()
+    static const int MaxCrashHandlers = 8;  //!< maximum number of loggers with the crash handler enabled
+    static const int LatencyBuckets = 24;   //!< buckets of the write latency histogram \sa Statistics
+
+    /*!
+     *  \brief Snapshot of the counters of a logger
+     *  \sa statistics()
+     */
+    struct Statistics {
+        quint64 enqueued;           //!< messages put in the queue, dumps of the flight recorder included
+        quint64 recorded;           //!< messages kept by the flight recorder
+        quint64 written;            //!< messages dispatched to the streams
+        quint64 bytes;              //!< bytes written in all the streams
+        quint64 write_errors;       //!< writes that failed
+        quint64 flushes;            //!< stream flushes
+        quint64 drops;              //!< messages lost: overwritten in the flight recorder or for a stream not open
+        quint64 queue_size;         //!< messages and barriers waiting to be written
+        quint64 queue_high_water;   //!< maximum queue_size so far
+        quint64 producer_waits;     //!< times addMessage() found the mutex locked
+        quint64 producer_wait_time; //!< nanoseconds spent by addMessage() waiting for the mutex
+        quint64 scheduling_refusals;    //!< changes of the writer scheduling refused \sa setWriterScheduling()
+        quint64 write_latency[LatencyBuckets];  //!< stream writes by duration: bucket 0 is under 1 µs,
+                                                //!< bucket i under 2^i µs, the last one everything else
+    };
+
+    /*!
+     *  \brief Default constructor
+     *  \param stream the stream to use
+     *  \param parent the parent of the logger if any
+     */
+    explicit QLogger(stream_ptr stream, QObject * parent = 0);
+
+    /*!
+     *  \brief Destructor
+     *  \sa QLogger()
+     */
+    virtual ~QLogger();
+
+    /*!
+     *  \brief Adds another stream the messages are dispatched to
+     *  It must be called before start().
+     *  \param stream the stream to add
+     *  \param level messages with a lower level are not written in this stream,
+     *         by severityRank(), Debug being the lowest
+     *  \param threaded if true the stream is opened and written by a dedicated thread,
+     *         see streamThread()
+     *  \return the index of the stream or -1 if the logger is already running
+     *          or there are already MaxStreams streams
+     *  \sa stream(), setStreamLevel()
+     */
+    int addStream(stream_ptr stream, const LogLevel& level = LogLevel::Debug, bool threaded = false);
+
+    /*!
+     *  \brief getter
+     *  \return the number of streams, the one passed to the constructor included
+     *  \sa addStream()
+     */
+    int streamCount() const;
+
+    /*!
+     *  \brief getter
+     *  \param index of the stream, 0 is the one passed to the constructor
+     *  \return a reference to the stream
+     *  \sa _sinks
+     */
+    stream_ptr& stream(int index = 0);
+
+    /*!
+     *  \brief Returns the thread a stream is written from
+     *  Objects used by a stream, e.g. the socket of QLoggerSocketStream,
+     *  must have the affinity of this thread.
+     *  \param index of the stream
+     *  \return the dedicated thread of a threaded stream, otherwise the logger itself
+     */
+    QThread* streamThread(int index);
+
+    /*!
+     *  \brief getter
+     *  \param index of the stream
+     *  \return the minimum level of the messages written in the stream
+     *  \sa setStreamLevel()
+     */
+    LogLevel streamLevel(int index) const;
+
+    /*!
+     *  \brief getter
+     *  \param level
+     *  \return the indexes of the streams messages of level are routed to
+     *  \sa setLevelRoute()
+     */
+    QList<int> levelRoute(const LogLevel& level) const;
+
+    /*!
+     *  \brief getter
+     *  \param category
+     *  \return the indexes of the streams messages of category are routed to,
+     *          empty if the category has no route of its own
+     *  \sa setCategoryRoute()
+     */
+    QList<int> categoryRoute(const QString& category) const;
+
+    /*!
+     *  \brief Checks if a message would be written or recorded
+     *  That's false if the level of the category is higher or no stream
+     *  accepts the level and the flight recorder doesn't keep it.
+     *  It takes no lock: the levels are read from atomics and from the
+     *  snapshot of the category levels.
+     *  \param level
+     *  \param category
+     *  \return true if a message of level and category is worth building
+     *  \sa categoryLevel(), streamLevel(), setFlightRecorder()
+     */
+    bool isEnabled(const LogLevel& level, const QString& category = QString()) const;
+
+    /*!
+     *  \brief Checks if the messages are being written
+     *  \return true if the logger runs in its own thread or in a QLoggerWriterPool
+     */
+    bool isWriting() const;
+
+    /*!
+     *  \brief Returns the minimum level of the messages of a category
+     *  Categories are hierarchical, with dots as separators: without a level
+     *  of its own "net.tls.handshake" takes the one of "net.tls", then of "net"
+     *  and finally of "", the root, which applies to the messages without
+     *  category too. Everything is enabled by default, the root level is Debug.
+     *  Levels compare by severityRank(), so setCategoryLevel("net", LogLevel::Debug)
+     *  enables Debug for "net" alone while the root stays at Info.
+     *  \param category
+     *  \return the effective level of category
+     *  \sa setCategoryLevel(), QLoggerCategory
+     */
+    LogLevel categoryLevel(const QString& category) const;
+
+    /*!
+     *  \brief getter
+     *  \return the minimum level of the messages going in the priority queue
+     *  \sa setPriorityLevel()
+     */
+    LogLevel priorityLevel() const;
+
+    /*!
+     *  \brief getter
+     *  \return the backlog above which Fatal messages are written synchronously, negative if never
+     *  \sa setSynchronousFatalThreshold()
+     */
+    int synchronousFatalThreshold() const;
+
+    /*!
+     *  \brief Keeps the messages not yet flushed in a journal dumped on a crash
+     *  Every message is also copied in a fixed-size in-memory ring. If the process
+     *  receives SIGSEGV, SIGABRT, SIGBUS, SIGFPE or SIGILL, a signal handler writes
+     *  with async-signal-safe calls only the part of the ring which hasn't been
+     *  flushed yet in the first stream, using its QLoggerStream::handle(), or in
+     *  stderr if it has none. Then the previous handler of the signal is restored and
+     *  the signal raised again.
+     *  The handler runs on an alternate signal stack, so a stack overflow is dumped
+     *  too. The stack is given to the calling thread, the writer threads and the
+     *  threads adding messages; other threads only have the one they set themselves.
+     *
+     *  The writer thread flushes the streams it writes itself when the queue is
+     *  drained or half of the journal hasn't been flushed yet. The journal ignores
+     *  the routes and threaded streams, and a few messages can be repeated in the
+     *  dump: a crash is better with duplicates than with holes.
+     *  It must be called before start() and works only on Unix.
+     *  \param journalSize size in bytes of the ring, rounded up to a power of 2
+     *  \return true if successful, false if unsupported, already enabled or
+     *          MaxCrashHandlers loggers have already enabled it
+     */
+    bool enableCrashHandler(int journalSize = 1 << 20);
+
+    /*!
+     *  \brief Routes Qt's own messages, qDebug(), qWarning() and the others, in a logger
+     *  A Qt message handler is installed, for the whole process: it adds every
+     *  message to logger instead of printing it on stderr. QtDebugMsg becomes
+     *  Debug, QtInfoMsg Info, QtWarningMsg and QtCriticalMsg Warning and
+     *  QtFatalMsg Fatal, which is flushed before Qt aborts. Thresholds compare
+     *  severityRank(), so a qDebug() ranks below a qInfo(). The category of the
+     *  QMessageLogContext is the category of the message, "qt" for the default
+     *  one, and its file, line and function become fields when available.
+     *
+     *  Messages emitted by a thread while it runs QLogger code, like the logger's
+     *  own debugging output or a stream writing with qDebug(), go to the previous
+     *  handler instead, so a logger never feeds itself.
+     *  Calling it again just switches to another logger. The handler must be
+     *  uninstalled before logger is destroyed, the destructor does it as a last resort.
+     *  \param logger receiving the messages, nullptr is the same as uninstallMessageHandler()
+     *  \sa uninstallMessageHandler()
+     */
+    static void installMessageHandler(QLogger* logger);
+
+    /*!
+     *  \brief Restores the Qt message handler replaced by installMessageHandler()
+     */
+    static void uninstallMessageHandler();
+
+    /*!
+     *  \brief getter
+     *  \return the level from which messages aren't kept by the flight recorder
+     *  \sa setFlightRecorder()
+     */
+    LogLevel flightRecorderLevel() const;
+
+    /*!
+     *  \brief getter
+     *  \return the number of messages the flight recorder keeps, 0 if disabled
+     *  \sa setFlightRecorder()
+     */
+    int flightRecorderCapacity() const;
+
+    /*!
+     *  \brief Returns the counters of the logger
+     *  The counters are read without locking, each writing thread keeps its
+     *  own and they are copied consistently. It can be called at any time.
+     *  \return a snapshot of the statistics
+     */
+    Statistics statistics() const;
+
+    /*!
+     *  \brief Returns how long messages waited between addMessage() and the end of their write
+     *  Messages are timestamped with a monotonic clock when enqueued and every
+     *  write in a stream adds a value. It can be called at any time.
+     *  \return the histogram of the latencies in nanoseconds since the logger started
+     *  \sa setLatencySummaryInterval()
+     */
+    QLoggerHistogram endToEndLatency() const;
+
+    /*!
+     *  \brief getter
+     *  \return the interval between two latency summaries in milliseconds, 0 if disabled
+     *  \sa setLatencySummaryInterval()
+     */
+    int latencySummaryInterval() const;
+
+    /*!
+     *  \brief getter
+     *  \return how the fields of the messages are rendered
+     *  \sa setFieldFormat()
+     */
+    FieldFormat fieldFormat() const;
+
+    /*!
+     *  \brief getter
+     *  \return how the messages are written
+     *  \sa setOutputFormat()
+     */
+    OutputFormat outputFormat() const;
+
+    /*!
+     *  \brief getter
+     *  \return the CPUs the writer thread is pinned to, empty if it can run on all of them
+     *  \sa setWriterAffinity()
+     */
+    QList<int> writerAffinity() const;
+
+    /*!
+     *  \brief getter
+     *  \return the scheduling policy of the writer thread
+     *  \sa setWriterScheduling()
+     */
+    SchedulingPolicy writerSchedulingPolicy() const;
+
+    /*!
+     *  \brief getter
+     *  \return the nice value of the writer thread
+     *  \sa setWriterScheduling()
+     */
+    int writerNice() const;
+
+    /*!
+     *  \brief getter
+     *  \return the backlog raising the priority of the writer thread, negative if disabled
+     *  \sa setAdaptivePriority()
+     */
+    int adaptivePriorityThreshold() const;
+
+    /*!
+     *  \brief getter
+     *  Messages built by the writer thread have an empty body until then.
+     *  \return a copy of the messages that have to be written
+     *  \sa addMessage()
+     */
+    QStringList messages() const;
+
+    /*!
+     *  \brief To use when checking for errors.
+     *  Use this after the entire work of the QLogger thread.
+     *  \return the description of the last error
+     */
+    QString errorString() const;
+
+    /*!
+     *  \brief Returns the format for the message
+     *  This must return a string in arg form, e.g.("[%1] %2 %3") that represents
+     *  the format for the messages. Note that by %1 is datetime, %2 is the log level
+     *  and %3 is the message body.
+     *  \return the format of the message
+     *  \sa logLevelToString(), datetimeFormat()
+     */
+    QString formatString() const;
+
+    /*!
+     *  \brief Returns the datetime format to be used.
+     *  It can be reimplemented by subclasses.
+     *  \return the string containg the datetime format
+     */
+    QString datetimeFormat() const;
+public slots:
+    /*!
+     *  \brief Adds a message to the list
+     *  \param message
+     *  \param level
+     *  \param category used to pick the streams, see setCategoryRoute()
+     *  \sa messages()
+     */
+    void addMessage(const QString& message, const LogLevel& level, const QString& category = QString());
+
+    /*!
+     *  \brief Adds a message with structured fields to the list
+     *  The fields are kept typed in the record and the writer thread formats
+     *  the message, appending them to its body as fieldFormat() says, e.g.
+     *  \code
+     *      logger.addMessage("request served", QLogger::LogLevel::Info,
+     *                        {{"path", path}, {"status", 200}, {"seconds", 0.012}});
+     *  \endcode
+     *  Messages are formatted by the calling thread as usual when the crash
+     *  handler is enabled or the message is written synchronously.
+     *  \param message
+     *  \param level
+     *  \param fields appended to the message, in order
+     *  \param category used to pick the streams, see setCategoryRoute()
+     *  \sa QLoggerField, setFieldFormat()
+     */
+    void addMessage(const QString& message, const LogLevel& level, const QLoggerFields& fields,
+                    const QString& category = QString());
+
+    /*!
+     *  \brief Starts a message built piece by piece, added when the returned object is destroyed
+     *  \code
+     *      logger.record(QLogger::LogLevel::Info) << "served " << bytes << " bytes in " << seconds << "s";
+     *  \endcode
+     *  \param level of the message
+     *  \param category used to pick the streams, see setCategoryRoute()
+     *  \return the builder
+     *  \sa QLoggerRecord, addMessage()
+     */
+    QLoggerRecord record(const LogLevel& level, const QString& category = QString());
+
+    /*!
+     *  \brief Adds a message built by a callable, called only if isEnabled()
+     *  \code
+     *      logger.addMessage([&]() { return dumpState(); }, QLogger::LogLevel::Debug);
+     *  \endcode
+     *  \param function callable returning something convertible to QString,
+     *         called by the calling thread
+     *  \param level
+     *  \param category used to pick the streams, see setCategoryRoute()
+     */
+    template <typename Function,
+              typename = typename std::enable_if<std::is_convertible<
+                  decltype(std::declval<Function&>()()), QString>::value>::type>
+    void addMessage(Function&& function, const LogLevel& level, const QString& category = QString())
+    {
+        if (isEnabled(level, category))
+            addRecord(QString(function()), level, QLoggerFields(), category, false);
+    }
+
+    /*!
+     *  \brief Adds a message built by a callable called by the writer thread, only if isEnabled()
+     *  The callable is moved in the record and called right before formatting
+     *  the message, so the cost of building it is taken off the calling thread.
+     *  It must then own what it uses: capture by value or by move, never by
+     *  reference to locals. Its type is checked at compile time: it must be an
+     *  rvalue, movable and return something convertible to QString.
+     *  Fatal messages, and all of them when the crash handler is enabled, are
+     *  built by the calling thread anyway since they must be written at once.
+     *  \code
+     *      std::shared_ptr<const Snapshot> snapshot = takeSnapshot();
+     *      logger.addMessage(QLogger::WriterThread(), [snapshot]() { return snapshot->toString(); },
+     *                        QLogger::LogLevel::Debug);
+     *  \endcode
+     *  \param function callable returning something convertible to QString
+     *  \param level
+     *  \param category used to pick the streams, see setCategoryRoute()
+     */
+    template <typename Function>
+    void addMessage(WriterThread, Function&& function, const LogLevel& level,
+                    const QString& category = QString())
+    {
+        using Callable = typename std::decay<Function>::type;
+
+        static_assert(!std::is_lvalue_reference<Function>::value,
+                      "the callable goes to the writer thread: move it, e.g. with std::move()");
+        static_assert(!std::is_pointer<Callable>::value || std::is_function<
+                          typename std::remove_pointer<Callable>::type>::value,
+                      "the callable goes to the writer thread: pass it by value, not by pointer");
+        static_assert(std::is_move_constructible<Callable>::value,
+                      "the callable goes to the writer thread: it must be movable");
+        static_assert(std::is_convertible<decltype(std::declval<Callable&>()()), QString>::value,
+                      "the callable must return something convertible to QString");
+
+        if (isEnabled(level, category))
+            addLazyRecord(std::make_shared<LazyMessageImpl<Callable>>(std::move(function)), level, category);
+    }
+
+    /*!
+     *  \brief Writes the messages held by the flight recorder through the streams
+     *  It's a slot, so it can be connected to any signal that should trigger a dump.
+     *  \sa setFlightRecorder()
+     */
+    void dumpFlightRecorder();
+
+    /*!
+     *  \brief Enqueues a barrier behind the messages added so far
+     *  The returned future finishes once the writer thread has written every
+     *  message enqueued before the barrier, the logger keeps running.
+     *  Its result is true if all those writes succeeded (and the stream flush
+     *  when sync is set), false if some failed or the logger has already stopped.
+     *  \param sync if true the stream is also flushed, see QLoggerStream::flush()
+     *  \return a future to wait on, e.g. with waitForFinished()
+     *  \sa addMessage(), finishWriting()
+     */
+    QFuture<bool> flush(bool sync = false);
+
+    /*!
+     *  \brief Tells the thread to finish writing its messages and
+     *          then to terminate.
+     *  This function should be always used before calling
+     *  <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#wait">QThread::wait()</a>
+     *  in order
+     *  to wait the logger until it has finished
+     */
+    void finishWriting();
+
+    /*!
+     *  \brief setFormatString
+     *  \param formatString
+     *  \sa formatString()
+     */
+    void setFormatString(const QString& formatString);
+
+    /*!
+     *  \brief setDatetimeFormat
+     *  \param datetimeFormat
+     *  \sa datetimeFormat()
+     */
+    void setDatetimeFormat(const QString& datetimeFormat);
+
+    /*!
+     *  \brief Sets how the fields of the messages are rendered
+     *  It can be called while the logger is running, messages not yet
+     *  formatted use the new format. Default is FieldFormat::KeyValue.
+     *  \param format
+     *  \sa fieldFormat(), addMessage()
+     */
+    void setFieldFormat(const FieldFormat& format);
+
+    /*!
+     *  \brief Sets how the messages are written
+     *  With OutputFormat::JsonLines "ts" is the ISO 8601 UTC datetime with
+     *  milliseconds, e.g. "2024-05-01T08:30:00.125Z", formatString(), datetimeFormat() and fieldFormat() are ignored
+     *  and the fields shouldn't be named ts, level, msg or category.
+     *  It can be called while the logger is running, messages not yet
+     *  formatted use the new format. Default is OutputFormat::Text.
+     *  \param format
+     *  \sa outputFormat()
+     */
+    void setOutputFormat(const OutputFormat& format);
+
+    /*!
+     *  \brief Sets the minimum level of the messages written in a stream
+     *  It can be called while the logger is running. The constructor's stream
+     *  starts at Debug, so it writes everything.
+     *  \param index of the stream
+     *  \param level
+     *  \sa streamLevel(), severityRank()
+     */
+    void setStreamLevel(int index, const LogLevel& level);
+
+    /*!
+     *  \brief Routes the messages of a level to some streams only
+     *  By default every level is routed to all the streams. Streams still
+     *  discard the messages below their own level.
+     *  It can be called while the logger is running.
+     *  \param level
+     *  \param streams indexes of the streams
+     *  \sa levelRoute(), setCategoryRoute()
+     */
+    void setLevelRoute(const LogLevel& level, const QList<int>& streams);
+
+    /*!
+     *  \brief Routes the messages of a category to some streams only
+     *  A category route takes the precedence over the level route.
+     *  It can be called while the logger is running.
+     *  \param category
+     *  \param streams indexes of the streams
+     *  \sa categoryRoute(), removeCategoryRoute(), addMessage()
+     */
+    void setCategoryRoute(const QString& category, const QList<int>& streams);
+
+    /*!
+     *  \brief Removes the route of a category, its messages follow the level routes again
+     *  \param category
+     *  \sa setCategoryRoute()
+     */
+    void removeCategoryRoute(const QString& category);
+
+    /*!
+     *  \brief Restores the default routes: everything goes to all the streams
+     */
+    void clearRoutes();
+
+    /*!
+     *  \brief Sets the minimum level of the messages of a category and of its subcategories
+     *  Messages below it are discarded by addMessage(). It can be called while
+     *  the logger is running, the QLoggerCategory objects see the change at
+     *  their next check.
+     *  \param category e.g. "net" for "net", "net.tls", "net.tls.handshake"..., "" for all
+     *  \param level
+     *  \sa categoryLevel(), removeCategoryLevel()
+     */
+    void setCategoryLevel(const QString& category, const LogLevel& level);
+
+    /*!
+     *  \brief Removes the level of a category, it inherits the one of its parent again
+     *  \param category
+     *  \sa setCategoryLevel()
+     */
+    void removeCategoryLevel(const QString& category);
+
+    /*!
+     *  \brief Sets the minimum level of the messages going in the priority queue
+     *  run() always writes all the priority messages before the others, so they
+     *  don't wait behind a backlog. Default is LogLevel::Fatal.
+     *  \param level
+     *  \sa priorityLevel()
+     */
+    void setPriorityLevel(const LogLevel& level);
+
+    /*!
+     *  \brief Makes Fatal messages bypass the queue when the backlog is too long
+     *  When more than backlog messages are waiting, addMessage() writes a Fatal
+     *  message in the streams and flushes them before returning, so it survives
+     *  an abort right after. The flight recorder's messages are written just
+     *  before it the same way. Threaded streams still get them through their
+     *  queue, ahead of the ordinary messages.
+     *  Note that the streams are then written from the calling thread, which
+     *  doesn't suit streams bound to the logger thread like QLoggerSocketStream.
+     *  \param backlog a negative value means never, which is the default
+     *  \sa synchronousFatalThreshold(), setPriorityLevel()
+     */
+    void setSynchronousFatalThreshold(int backlog);
+
+    /*!
+     *  \brief Keeps the messages below level in memory instead of writing them
+     *  Those messages are neither formatted nor written: they go in a ring of
+     *  capacity entries, overwriting the oldest ones. The ring is dumped through
+     *  the streams by dumpFlightRecorder() and right before any Fatal message,
+     *  so an incident comes with its recent context.
+     *  The messages recorded so far are dumped before applying the change.
+     *  \param level messages with a lower severityRank() are recorded, e.g. Warning records
+     *         Info and Debug, Info records Debug only
+     *  \param capacity number of messages kept, 0 disables the flight recorder
+     *  \sa flightRecorderLevel(), flightRecorderCapacity()
+     */
+    void setFlightRecorder(const LogLevel& level, int capacity);
+
+    /*!
+     *  \brief Makes the logger log a summary of endToEndLatency() periodically
+     *  While messages are being written, an Info message of category "qlogger"
+     *  with QLoggerHistogram::summary() is added every msecs milliseconds.
+     *  \param msecs interval, 0 or less disables the summaries, which is the default
+     *  \sa latencySummaryInterval()
+     */
+    void setLatencySummaryInterval(int msecs);
+
+    /*!
+     *  \brief Pins the writer thread to some CPUs
+     *  Threaded streams started afterwards inherit the affinity.
+     *  It can be called while the logger is running, the writer thread
+     *  applies it before its next message. Linux only, ignored elsewhere.
+     *  \param cpus indexes of the CPUs, empty to allow all of them
+     *  \sa writerAffinity()
+     */
+    void setWriterAffinity(const QList<int>& cpus);
+
+    /*!
+     *  \brief Sets the scheduling policy and the nice value of the writer thread
+     *  Threaded streams started afterwards inherit the nice value.
+     *  Lowering the nice value below the current one needs CAP_SYS_NICE or
+     *  a RLIMIT_NICE allowing it (ulimit -e, limits.conf \c rtprio / \c nice).
+     *  A refusal sets errorString() and counts in Statistics::scheduling_refusals,
+     *  the writer keeps running with the scheduling it had.
+     *  It can be called while the logger is running, the writer thread
+     *  applies it before its next message. Linux only, ignored elsewhere.
+     *  Default is SchedulingPolicy::Inherit.
+     *  \param policy
+     *  \param nice from -20 to 19, ignored with SchedulingPolicy::Inherit
+     *  \sa writerSchedulingPolicy(), writerNice(), setAdaptivePriority()
+     */
+    void setWriterScheduling(const SchedulingPolicy& policy, int nice = 0);
+
+    /*!
+     *  \brief Raises the priority of the writer thread while the backlog is long
+     *  When more than backlog messages are waiting the writer thread switches
+     *  to SCHED_OTHER with the given nice value, never higher than the one it
+     *  started with, once the queue is drained it goes back to
+     *  writerSchedulingPolicy() and writerNice().
+     *  It pays off with SchedulingPolicy::Batch or a positive writerNice(): the
+     *  writer stays out of the way while the queue is short and catches up
+     *  when it isn't. A negative nice value, as the default one, needs
+     *  CAP_SYS_NICE or a RLIMIT_NICE allowing it: without them the raise is
+     *  refused as said in setWriterScheduling(). Linux only, ignored elsewhere.
+     *  \param backlog a negative value disables it, which is the default
+     *  \param nice nice value while raised
+     *  \sa adaptivePriorityThreshold()
+     */
+    void setAdaptivePriority(int backlog, int nice = -5);
+protected:
+
+    /*!
+      * \brief Run method reimplemented from <a href = "http://qt-project.org/doc/qt-4.8/qthread.html#run">run()</a>
+      */
+    void run() Q_DECL_OVERRIDE;
+
+    /*!
+     *  \brief Transform a log level in a readable format
+     *  It can be reimplemented by subclasses.
+     *  \param level log level to translate
+     *  \return the formatted string
+     */
+    virtual QString logLevelToString(const LogLevel& level) const;
+private:
+    friend class QLoggerCategory;   // reads _category_generation
+    friend class QLoggerRecord;     // calls addRecord()
+    friend class QLoggerWriterPool; // writes the messages instead of run()
+
+    /*!
+     *  \brief A pending flush() request
+     */
+    struct FlushRequest {
+        bool                    sync;       //!< whether to flush the streams too
+        QAtomicInt              pending;    //!< writer threads that still have to reach the barrier
+        QAtomicInt              failed;     //!< set if one of them failed
+        QFutureInterface<bool>  promise;    //!< backs the future returned by flush()
+    };
+
+    /*!
+     *  \brief A message built on the writer thread
+     *  \sa addMessage(WriterThread, Function&&, const LogLevel&, const QString&)
+     */
+    struct LazyMessage {
+        virtual ~LazyMessage() {}
+
+        /*!
+         *  \brief Builds the message, called once
+         */
+        virtual QString evaluate() = 0;
+    };
+
+    /*!
+     *  \brief A LazyMessage calling a Callable
+     */
+    template <typename Callable>
+    struct LazyMessageImpl : public LazyMessage {
+        explicit LazyMessageImpl(Callable function) : function(std::move(function)) {}
+        QString evaluate() Q_DECL_OVERRIDE { return function(); }
+
+        Callable function;  //!< the callable given to addMessage()
+    };
+
+    /*!
+     *  \brief An entry of the queue, either a message or a flush barrier
+     */
+    struct Record {
+        QByteArray                      data;       /*!< formatted UTF-8 message, shared by all the streams,
+                                                         null until run() formats a message with fields */
+        QDateTime                       datetime;   //!< when the message was added, set only if data is null
+        QString                         message;    //!< body of the message, set only if data is null
+        QByteArray                      utf8;       //!< body already UTF-8 encoded, used instead of message if not null
+        QLoggerFields                   fields;     //!< fields of the message, set only if data is null
+        std::shared_ptr<LazyMessage>    lazy;       //!< builds message, set only if data is null
+        LogLevel                        level;      //!< level of the message
+        QString                         category;   //!< category of the message, used for routing
+        quint64                         journal_end;    //!< end of the message in the crash journal, 0 if none
+        qint64                          enqueued_at;    //!< monotonic time of addMessage() in nanoseconds
+        qint64                          timestamp;  //!< when the message was added, milliseconds since the epoch
+        std::shared_ptr<FlushRequest>   barrier;    //!< set only for barriers \sa flush()
+    };
+
+    /*!
+     *  \brief A message held by the flight recorder, formatted only when dumped
+     */
+    struct FlightRecord {
+        QDateTime   datetime;   //!< when the message was added
+        LogLevel    level;      //!< level of the message
+        QString     category;   //!< category of the message
+        QString     message;    //!< body of the message
+        QByteArray  utf8;       //!< body already UTF-8 encoded, used instead of message if not null
+        QLoggerFields   fields; //!< fields of the message
+        std::shared_ptr<LazyMessage>    lazy;   //!< builds message, if set
+    };
+
+    class SinkWriter;
+
+    using route_mask = quint32;     //!< bit i set means the stream i gets the message
+
+    static const int LevelCount = 4;    //!< number of values of LogLevel
+
+    /*!
+     *  \brief The routing table
+     */
+    struct Routes {
+        route_mask                  levels[LevelCount];     //!< route of each level, indexed by LogLevel
+        QHash<QString, route_mask>  categories;             //!< routes of the categories having one
+    };
+
+    /*!
+     *  \brief Where and how the writer thread runs
+     *  \sa setWriterAffinity(), setWriterScheduling(), setAdaptivePriority()
+     */
+    struct Scheduling {
+        bool        pinned;         //!< set by setWriterAffinity(), until then the affinity isn't touched
+        QList<int>  cpus;           //!< CPUs of the writer thread, empty for all
+        int         policy;         //!< SchedulingPolicy
+        int         nice;           //!< nice value with policy
+        int         raised_nice;    //!< nice value while the priority is raised
+    };
+
+    /*!
+     *  \brief Applies the changes of _scheduling and the adaptive priority, called by the writer thread
+     *  It costs two atomic loads when there is nothing to do.
+     */
+    void updateScheduling();
+
+    /*!
+     *  \brief Adds a message, the body of the public addMessage()
+     *  \param filter whether to check the level of the category, false if the caller did
+     */
+    void addRecord(const QString& message, const LogLevel& level, const QLoggerFields& fields,
+                   const QString& category, bool filter,
+                   const std::shared_ptr<LazyMessage>& lazy = std::shared_ptr<LazyMessage>());
+
+    /*!
+     *  \brief Adds a message whose body is already UTF-8 encoded, as QLoggerRecord builds it
+     *  The bytes go to the streams as they are, without a round trip through QString.
+     *  \param utf8 the UTF-8 encoded body of the message
+     *  \param filter whether to check the level of the category, false if the caller did
+     */
+    void addRecord(const QByteArray& utf8, const LogLevel& level, const QLoggerFields& fields,
+                   const QString& category, bool filter);
+
+    /*!
+     *  \brief The body of both addRecord() overloads
+     *  \param utf8 the body already UTF-8 encoded, used instead of message if not null
+     */
+    void addRecord(const QString& message, const QByteArray& utf8, const LogLevel& level,
+                   const QLoggerFields& fields, const QString& category, bool filter,
+                   const std::shared_ptr<LazyMessage>& lazy);
+
+    /*!
+     *  \brief Adds a message built by the writer thread, when possible
+     *  \param message builds the body of the message
+     */
+    void addLazyRecord(const std::shared_ptr<LazyMessage>& message, const LogLevel& level,
+                       const QString& category);
+
+    /*!
+     *  \brief Looks up the effective level of a category
+     *  It takes no lock, it reads the snapshot of the category levels.
+     *  \return the severityRank() of the level
+     *  \sa categoryLevel()
+     */
+    int categoryThreshold(const QString& category) const;
+
+    /*!
+     *  \brief Looks up the effective level of a category in levels
+     *  \param levels ranks of the categories having one, may be null
+     *  \return the severityRank() of the level
+     */
+    static int categoryThreshold(const QHash<QString, int>* levels, const QString& category);
+
+    /*!
+     *  \brief Inverse of severityRank()
+     *  \param rank from 0 to 3
+     *  \return the level
+     */
+    static LogLevel levelOfRank(int rank);
+
+    /*!
+     *  \brief Looks up the streams a record goes to, called by the writer thread
+     *  It works on a private copy of _routes refreshed only when they change.
+     *  \param record
+     *  \return the route of the record
+     */
+    route_mask route(const Record& record);
+
+    /*!
+     *  \brief Publishes a change of _routes to the writer thread
+     *  It must be called with _mutex locked.
+     */
+    void routesChanged();
+
+    /*!
+     *  \brief Converts a list of stream indexes in a route_mask
+     */
+    static route_mask toMask(const QList<int>& streams);
+
+    /*!
+     *  \brief Converts a route_mask in a list of stream indexes
+     */
+    static QList<int> fromMask(route_mask mask);
+
+    /*!
+     *  \brief A stream the messages are dispatched to
+     */
+    struct Sink {
+        stream_ptr                  stream;     //!< the stream itself
+        QAtomicInt                  level;      //!< severityRank() of the minimum level written \sa setStreamLevel()
+        std::unique_ptr<SinkWriter> writer;     //!< dedicated thread, null if written by the logger
+        bool                        write_ok;   //!< false if a write failed since the last barrier
+    };
+
+    /*!
+     *  \brief Writes a record in the streams accepting it, called by the writer thread
+     *  \param record the message or barrier to dispatch
+     */
+    void dispatch(const Record& record);
+
+    /*!
+     *  \brief Formatting configuration, never modified once published in _format
+     *  \sa formatString(), datetimeFormat()
+     */
+    struct FormatSnapshot {
+        QString             format_string;      //!< \sa formatString()
+        QString             datetime_format;    //!< \sa datetimeFormat()
+        QVector<QByteArray> literals;           //!< format_string split around its placeholders, UTF-8 encoded
+        QVector<int>        arguments;          /*!< placeholder after each literal but the last:
+                                                     0 is the datetime, 1 the level and 2 the message */
+    };
+
+    using format_ptr = std::shared_ptr<const FormatSnapshot>;  //!< pointer type of _format
+
+    using category_levels_ptr = std::shared_ptr<const QHash<QString, int>>;    //!< pointer type of _category_levels
+
+    /*!
+     *  \brief Splits a format string around %1, %2 and %3 once, so formatting is just appending
+     *  \return the new snapshot
+     */
+    static format_ptr compileFormat(const QString& formatString, const QString& datetimeFormat);
+
+    /*!
+     *  \brief Formats a message as formatString() says
+     *  It takes no lock, it can be called by any thread.
+     *  \param message the UTF-8 encoded body of the message
+     *  \return the UTF-8 encoded line
+     */
+    QByteArray formatMessage(const QDateTime& datetime, const LogLevel& level, const QString& category,
+                             const QByteArray& message, const QLoggerFields& fields) const;
+
+    /*!
+     *  \brief Formats a message as OutputFormat::JsonLines says
+     *  \param levelString the level, as logLevelToString() returns it
+     *  \param message the UTF-8 encoded body of the message
+     *  \return the UTF-8 encoded line
+     */
+    static QByteArray formatJsonLine(const QDateTime& datetime, const QString& levelString,
+                                     const QString& category, const QByteArray& message,
+                                     const QLoggerFields& fields);
+
+    /*!
+     *  \brief Puts a record in a queue and wakes the writer thread
+     *  It must be called with _mutex locked.
+     *  \param record the message, its journal_end is set here
+     *  \param priority whether it goes in the priority queue
+     */
+    void enqueue(Record& record, bool priority);
+
+    /*!
+     *  \brief Enqueues the messages of the flight recorder, oldest first, and empties it
+     *  It must be called with _mutex locked.
+     *  \param priority whether they go in the priority queue
+     *  \param records if set, the messages are appended there instead of being enqueued
+     */
+    void dumpFlightRecords(bool priority, QVector<Record>* records = nullptr);
+
+    /*!
+     *  \brief Writes records in order and flushes the streams, from the calling thread
+     *  \param records the messages to write, formatted here if deferred
+     *  \sa setSynchronousFatalThreshold()
+     */
+    void writeSynchronously(QVector<Record>& records);
+
+    /*!
+     *  \brief Formats a record whose formatting was deferred, does nothing otherwise
+     *  \param record
+     */
+    void formatDeferred(Record& record) const;
+
+    /*!
+     *  \brief Checks if a message belongs to the priority queue
+     *  \param level of the message
+     *  \return true if level isn't lower than priorityLevel()
+     */
+    bool isPriority(const LogLevel& level) const;
+
+    /*!
+     *  \brief Flushes the streams and marks the crash journal as flushed up to end
+     *  It must be called by the writer thread with _write_mutex locked.
+     *  \param end position in the journal
+     *  \sa enableCrashHandler()
+     */
+    void syncJournal(quint64 end);
+
+    /*!
+     *  \brief Adds a latency summary message if the interval has elapsed, called by the writer thread
+     *  \sa setLatencySummaryInterval()
+     */
+    void summarizeLatency();
+
+    /*!
+     *  \brief Opens the streams and starts the threaded ones, first thing of a writer
+     *  \return false if none could be opened, the logger is then stopped
+     */
+    bool openStreams();
+
+    /*!
+     *  \brief Writes the next message or barrier of the queues, called by the writer
+     *  \return false if the queues were empty
+     */
+    bool writeNext();
+
+    /*!
+     *  \brief Makes the crash journal durable when the queues are empty, called by the writer
+     */
+    void syncIdleJournal();
+
+    /*!
+     *  \brief Tells the streams written by the writer that the queues are empty
+     *  \sa QLoggerStream::drained()
+     */
+    void drainStreams();
+
+    /*!
+     *  \brief Closes the streams and stops the logger, last thing of a writer
+     */
+    void closeStreams();
+
+    /*!
+     *  \brief Wakes the writer, be it run() or a QLoggerWriterPool
+     *  It must be called with _mutex locked.
+     */
+    void wakeWriter();
+
+    /*!
+     *  \brief Marks a writer thread as done with a flush request
+     *  The last one completes the future.
+     *  \param request the request
+     *  \param ok false if some write or flush failed
+     */
+    static void releaseFlush(FlushRequest& request, bool ok);
+
+    /*!
+     *  \brief Completes a flush request with the given outcome
+     *  \param request the request to complete
+     *  \param ok result reported to the future
+     */
+    static void finishFlush(FlushRequest& request, bool ok);
+
+    /*!
+     *  \brief Fails and removes the barriers still in the queue, called when the logger stops
+     *  It must be called with _mutex locked.
+     */
+    void failPendingFlushes();
+
+    std::vector<Sink>   _sinks;         /*!< streams to use for writing the messages, the first one is
+                                             the constructor's \sa _messages */
+    QQueue<Record>      _messages;      /*!< messages and barriers to write \sa messages(), addMessage(), flush() */
+    QQueue<Record>      _priority_messages; /*!< messages to write before _messages \sa setPriorityLevel() */
+
+    mutable QMutex      _mutex;         //!< mutex to synchronize threads
+    QMutex              _write_mutex;   //!< serializes the writes of run() and writeSynchronously()
+    QWaitCondition      _empty;         //!< allows to wait while there aren't messages to be written
+    QAtomicInt          _finish;        //! if set to true, it tells that when the thread will have written all the messages,
+                                        //! then it will stop
+    QAtomicInt          _messages_size; //!< atomic int to ensure thread-safety. It's the size of both queues
+
+    QVector<FlightRecord>   _flight_records;    //!< ring of the flight recorder, empty if disabled
+    int                     _flight_level;      //!< messages whose severityRank() is below it are recorded
+    QAtomicInt              _flight_threshold;  //!< _flight_level, or the lowest rank if disabled, read by isEnabled()
+    int                     _flight_next;       //!< next slot of _flight_records to write
+    int                     _flight_count;      //!< messages in _flight_records
+
+    QAtomicInt          _priority_level;        //!< severityRank() of the priority level \sa setPriorityLevel()
+    QAtomicInt          _synchronous_threshold; //!< \sa setSynchronousFatalThreshold()
+
+    bool                _stopped;       //!< set when run() is over, flush() can't be honoured anymore
+
+    std::unique_ptr<QLoggerCrashJournal> _journal;  //!< copy of the messages for the crash handler, may be null
+
+    std::unique_ptr<QLoggerStatisticsBlock> _producer_statistics;   //!< updated with _mutex locked
+    std::unique_ptr<QLoggerStatisticsBlock> _writer_statistics;     //!< updated with _write_mutex locked
+
+    QAtomicInt          _field_format;      //!< FieldFormat \sa setFieldFormat()
+    QAtomicInt          _output_format;     //!< OutputFormat \sa setOutputFormat()
+
+    QAtomicInt          _summary_interval;  //!< milliseconds \sa setLatencySummaryInterval()
+    qint64              _last_summary;      //!< monotonic time of the last summary, used by the writer only
+
+    category_levels_ptr _category_levels;       /*!< severityRank() of the categories having one, null if none,
+                                                     replaced with _mutex locked by std::atomic_store() and read
+                                                     with std::atomic_load() \sa setCategoryLevel() */
+    QAtomicInt          _category_generation;   //!< bumped at each change of _category_levels
+
+    Routes              _routes;                    //!< routing table \sa setLevelRoute(), setCategoryRoute()
+    QAtomicInt          _routes_generation;         //!< bumped at each change of _routes
+    Routes              _writer_routes;             //!< copy of _routes owned by the writer thread
+    int                 _writer_routes_generation;  //!< generation of _writer_routes
+
+    Scheduling          _scheduling;                    //!< \sa setWriterScheduling()
+    QAtomicInt          _scheduling_generation;         //!< bumped at each change of _scheduling
+    QAtomicInt          _adaptive_threshold;            //!< \sa setAdaptivePriority()
+    int                 _writer_scheduling_generation;  //!< generation applied by the writer thread
+    bool                _writer_raised;                 //!< whether the writer thread runs with raised_nice
+    int                 _writer_base_policy;            //!< native policy of the writer thread when run() started
+    int                 _writer_base_nice;              //!< nice value of the writer thread when run() started
+
+    QAtomicPointer<QLoggerWriterPool>   _pool;  //!< pool writing the messages, null otherwise \sa QLoggerWriterPool::start()
+
+    std::shared_ptr<const QString>  _error_string;  /*!< description of the last error, replaced with
+                                                         std::atomic_store() and read with std::atomic_load() */
+
+    format_ptr          _format;    /*!< format of the messages, replaced with std::atomic_compare_exchange_weak()
+                                         and read with std::atomic_load(), so that readers and the formatter
+                                         never take _mutex \sa formatString(), datetimeFormat() */
+};
+
+/*!
+ *  \class QLoggerRecord ""
+ *  \brief The QLoggerRecord class
+ *  It builds a message with operator<< and adds it to its logger when destroyed,
+ *  see QLogger::record() and QLoggerCategory::record().
+ *  The text is encoded in UTF-8 in a buffer inside the object, on the stack,
+ *  and moves to the heap only for messages longer than InlineSize bytes.
+ *  Integers are converted by hand and floating point numbers by snprintf() under the
+ *  "C" locale, like QString::number() with format 'g' and precision 6 but with no
+ *  allocation. The buffer goes to the logger as UTF-8 bytes, never converted
+ *  to QString. A record for a disabled category does nothing at all.
+ */
+class QLOGGERSHARED_EXPORT QLoggerRecord
+{
+public:
+    static const int InlineSize = 256;  //!< bytes of text kept inside the object
+
+    /*!
+     *  \brief Move constructor, other won't add anything
+     */
+    QLoggerRecord(QLoggerRecord&& other);
+
+    QLoggerRecord(const QLoggerRecord&) = delete;
+    QLoggerRecord& operator=(const QLoggerRecord&) = delete;
+
+    /*!
+     *  \brief Destructor, adds the message unless already done
+     *  \sa commit()
+     */
+    ~QLoggerRecord();
+
+    /*!
+     *  \brief getter
+     *  \return false if the message is discarded, e.g. its category is disabled or it has been committed
+     */
+    bool isActive() const { return _logger != nullptr; }
+
+    /*!
+     *  \brief Adds the message to the logger now, the record becomes inactive
+     */
+    void commit();
+
+    QLoggerRecord& operator<<(const char* s);           //!< appends s, UTF-8 encoded
+    QLoggerRecord& operator<<(const QString& s);        //!< appends s
+    QLoggerRecord& operator<<(QLatin1String s);         //!< appends s
+    QLoggerRecord& operator<<(const QByteArray& s);     //!< appends s, UTF-8 encoded
+    QLoggerRecord& operator<<(QChar c);                 //!< appends c
+    QLoggerRecord& operator<<(char c);                  //!< appends c
+    QLoggerRecord& operator<<(bool b);                  //!< appends "true" or "false"
+    QLoggerRecord& operator<<(int n);                   //!< appends n in base 10
+    QLoggerRecord& operator<<(long n);                  //!< appends n in base 10
+    QLoggerRecord& operator<<(long long n);             //!< appends n in base 10
+    QLoggerRecord& operator<<(unsigned n);              //!< appends n in base 10
+    QLoggerRecord& operator<<(unsigned long n);         //!< appends n in base 10
+    QLoggerRecord& operator<<(unsigned long long n);    //!< appends n in base 10
+    QLoggerRecord& operator<<(double n);                //!< appends n like QString::number(n)
+    QLoggerRecord& operator<<(const QLoggerField& field);   //!< adds a field to the message, see QLoggerField
+private:
+    friend class QLogger;
+    friend class QLoggerCategory;
+
+    /*!
+     *  \brief Constructor, used by QLogger::record() and QLoggerCategory::record()
+     *  \param logger the message goes to, nullptr for an inactive record
+     *  \param filter whether QLogger checks the level of the category, false if the caller did
+     */
+    QLoggerRecord(QLogger* logger, const QLogger::LogLevel& level, const QString& category, bool filter);
+
+    /*!
+     *  \brief Makes room for size more bytes
+     *  \return where to write them
+     */
+    char* grow(int size);
+
+    /*!
+     *  \brief Appends size bytes of data
+     */
+    void append(const char* data, int size);
+
+    /*!
+     *  \brief Appends the digits of n, with a minus if negative is set
+     */
+    void appendNumber(unsigned long long n, bool negative);
+
+    QLogger*            _logger;        //!< where the message goes, nullptr if inactive
+    QLogger::LogLevel   _level;         //!< level of the message
+    QString             _category;      //!< category of the message
+    bool                _filter;        //!< \sa QLogger::addRecord()
+    QLoggerFields       _fields;        //!< fields added with operator<<
+
+    char*               _data;          //!< _inline or _heap.get()
+    int                 _size;          //!< bytes written in _data
+    int                 _capacity;      //!< size of _data
+    std::unique_ptr<char[]> _heap;      //!< buffer of long messages
+    char                _inline[InlineSize];    //!< buffer of short messages
+};
+
+/*!
+ *  \class QLoggerCategory ""
+ *  \brief The QLoggerCategory class
+ *  It's a named category of the messages of a logger, e.g. "net.tls.handshake",
+ *  meant to be created once per component and kept, e.g. as a static.
+ *  It caches the effective level of the category with the generation of the
+ *  levels of the logger it was read at, so isEnabled() takes two atomic loads
+ *  and no lock: when the levels change the logger bumps its generation and
+ *  the cache is refreshed at the next check.
+ *  The logger must outlive it.
+ *  \code
+ *      static QLoggerCategory tls(&logger, "net.tls");
+ *      if (tls.isEnabled(QLogger::LogLevel::Debug))
+ *          tls.log(describe(session), QLogger::LogLevel::Debug);
+ *  \endcode
+ *  \sa QLogger::setCategoryLevel()
+ */
+class QLOGGERSHARED_EXPORT QLoggerCategory
+{
+public:
+    /*!
+     *  \brief Default constructor
+     *  \param logger the messages are added to
+     *  \param name of the category, its parents are the prefixes ending before a dot
+     */
+    QLoggerCategory(QLogger* logger, const QString& name);
+
+    /*!
+     *  \brief getter
+     *  \return the name of the category
+     */
+    const QString& name() const { return _name; }
+
+    /*!
+     *  \brief getter
+     *  \return the logger of the category
+     */
+    QLogger* logger() const { return _logger; }
+
+    /*!
+     *  \brief Checks if the messages of a level are written, it can be called from any thread
+     *  \param level
+     *  \return true if level isn't lower than the effective level of the category
+     *  \sa QLogger::categoryLevel(), QLogger::severityRank()
+     */
+    bool isEnabled(const QLogger::LogLevel& level) const
+    {
+        int cached = _cache.load();
+        if ((cached >> GenerationShift) != (_logger->_category_generation.load() & GenerationMask))
+            cached = refresh();
+        return QLogger::severityRank(level) >= (cached & LevelMask);
+    }
+
+    /*!
+     *  \brief Adds a message of this category to the logger, if its level is enabled
+     *  \param message
+     *  \param level
+     *  \param fields of the message, if any
+     */
+    void log(const QString& message, const QLogger::LogLevel& level,
+             const QLoggerFields& fields = QLoggerFields()) const;
+
+    /*!
+     *  \brief Starts a message of this category built with operator<<
+     *  If level is disabled the record is inactive and costs nothing more.
+     *  \param level of the message
+     *  \return the builder
+     *  \sa QLogger::record()
+     */
+    QLoggerRecord record(const QLogger::LogLevel& level) const;
+private:
+    static const int GenerationShift    = 2;                    //!< the rank of the level takes the low 2 bits
+    static const int LevelMask          = 3;                    //!< mask of the rank in _cache
+    static const int GenerationMask     = 0x1fffffff;           //!< generations wrap at 2^29, so shifted they fit an int
+
+    /*!
+     *  \brief Reads the effective level from the logger and caches it
+     *  \return the new value of _cache
+     */
+    int refresh() const;
+
+    QLogger*            _logger;    //!< the logger the messages go to
+    QString             _name;      //!< name of the category
+    mutable QAtomicInt  _cache;     //!< generation << GenerationShift | severity rank, -1 if never read
+};
+
+/*!
+ *  \class QLoggerWriterPool ""
+ *  \brief The QLoggerWriterPool class
+ *  A few threads writing the messages of many loggers, instead of a thread each.
+ *  Start a logger with start() instead of QThread::start(), stop it as usual with
+ *  QLogger::finishWriting() and wait for it with wait() instead of QThread::wait().
+ *  addMessage() and everything else of QLogger work the same.
+ *
+ *  An idle thread of the pool takes the logger with the longest queue and writes
+ *  as many messages as were waiting, at most MaxBatch, before choosing again.
+ *  Busy loggers get more of the threads while idle ones cost nothing; a logger
+ *  passed over doubles its weight at each round, so it isn't starved. A logger
+ *  is written by a single thread at a time, so its messages keep their order.
+ *
+ *  Streams bound to a thread like QLoggerSocketStream don't suit a pool, threaded
+ *  streams still get a thread of their own. The writer scheduling settings,
+ *  QLogger::setWriterAffinity() and the like, don't apply to pooled loggers.
+ *  The loggers have to be finished and waited for before destroying the pool.
+ * \code
+ *     QLoggerWriterPool pool(2);
+ *     std::vector<std::unique_ptr<QLogger>> loggers;
+ *     for (const QString& module : modules) {
+ *         loggers.emplace_back(new QLogger(QLogger::stream_ptr(new QLoggerFileStream(module + ".log"))));
+ *         pool.start(loggers.back().get());
+ *     }
+ *     ...
+ *     for (auto& logger : loggers) {
+ *         logger->finishWriting();
+ *         pool.wait(logger.get());
+ *     }
+ * \endcode
+ */
+class QLOGGERSHARED_EXPORT QLoggerWriterPool
+{
+public:
+    static const int MaxBatch = 1024;   //!< maximum messages of a logger written in a row
+
+    /*!
+     *  \brief Constructor, starts the threads
+     *  \param threads number of threads, at least 1
+     */
+    explicit QLoggerWriterPool(int threads = 2);
+
+    /*!
+     *  \brief Destructor, stops the threads once the queues are empty
+     */
+    ~QLoggerWriterPool();
+
+    QLoggerWriterPool(const QLoggerWriterPool&) = delete;
+    QLoggerWriterPool& operator=(const QLoggerWriterPool&) = delete;
+
+    /*!
+     *  \brief getter
+     *  \return the number of threads
+     */
+    int threadCount() const;
+
+    /*!
+     *  \brief getter
+     *  \return the number of loggers being written
+     */
+    int loggerCount() const;
+
+    /*!
+     *  \brief Starts writing the messages of a logger, in place of QThread::start()
+     *  \param logger a logger neither running nor in a pool
+     *  \return false if the logger is already writing
+     */
+    bool start(QLogger* logger);
+
+    /*!
+     *  \brief Waits for a logger to stop after QLogger::finishWriting(), in place of QThread::wait()
+     *  \param logger
+     *  \param msecs timeout
+     *  \return true if the logger isn't in the pool anymore
+     */
+    bool wait(QLogger* logger, unsigned long msecs = ULONG_MAX);
+
+private:
+    friend class QLogger;   // calls wake()
+
+    class Worker;
+
+    /*!
+     *  \brief A logger written by the pool
+     */
+    struct Entry {
+        QLogger*    logger;     //!< the logger
+        bool        busy;       //!< a thread is writing it
+        bool        opened;     //!< its streams are open
+        int         skipped;    //!< rounds it had messages but another logger was chosen
+    };
+
+    /*!
+     *  \brief Chooses the next logger to write, it must be called with _mutex locked
+     *  \return the index in _entries, -1 if there is nothing to do
+     */
+    int choose();
+
+    /*!
+     *  \brief Writes a batch of messages of a logger, called without _mutex locked
+     *  \param logger
+     *  \param opened false if its streams have to be opened first
+     *  \return true if the logger is over
+     */
+    bool write(QLogger* logger, bool opened);
+
+    /*!
+     *  \brief Body of the threads
+     */
+    void work();
+
+    /*!
+     *  \brief Wakes a thread if some is sleeping, called by the loggers
+     */
+    void wake();
 
-    QString             _format_string;     //!< format of the message \sa formatString()
-    QString             _datetime_format;   //!< datetime format to be used \sa datetimeFormat()
+    std::vector<std::unique_ptr<Worker>>    _workers;   //!< the threads
+    QVector<Entry>                          _entries;   //!< loggers being written
+    mutable QMutex                          _mutex;     //!< protects _entries and _stop
+    QWaitCondition                          _work;      //!< threads wait on it for messages
+    QWaitCondition                          _done;      //!< wait() waits on it for a logger to leave
+    QAtomicInt                              _sleeping;  //!< threads waiting on _work
+    bool                                    _stop;      //!< set by the destructor
 };
 
 #endif // QLOGGER_H
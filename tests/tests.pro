@@ -0,0 +1,12 @@
+QT       -= gui
+QT       += network testlib
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_qlogger
+TEMPLATE = app
+
+INCLUDEPATH += ../src
+LIBS += -L$$OUT_PWD/../src -lQLogger
+
+SOURCES += tst_qlogger.cpp
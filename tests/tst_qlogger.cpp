@@ -0,0 +1,384 @@
+#include <QtTest>
+
+#include "qlogger.h"
+
+/*
+ *  Unit tests of QLogger, checking the exact output.
+ *  Run them with "make check" or by starting tst_qlogger.
+ */
+
+namespace {
+
+/*!
+ *  \brief Checks if a byte must be escaped in a JSON string, one byte at a time
+ */
+bool needsEscape(uchar byte)
+{
+    return byte < 0x20 || byte == '"' || byte == '\\';
+}
+
+/*!
+ *  \brief Encodes a JSON string one byte at a time, the reference of QLoggerJson::appendString()
+ */
+QByteArray referenceJson(const QByteArray& data)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    QByteArray out("\"");
+    for (int i = 0; i < data.size(); ++i) {
+        const uchar byte = static_cast<uchar>(data.at(i));
+        switch (byte) {
+        case '"':   out += "\\\"";  break;
+        case '\\':  out += "\\\\";  break;
+        case '\n':  out += "\\n";   break;
+        case '\r':  out += "\\r";   break;
+        case '\t':  out += "\\t";   break;
+        default:
+            if (byte < 0x20) {
+                out += "\\u00";
+                out += hex[byte >> 4];
+                out += hex[byte & 0xf];
+            }
+            else {
+                out += data.at(i);
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+/*!
+ *  \brief QLoggerJson::appendString() in a new array
+ */
+QByteArray json(const QByteArray& data)
+{
+    QByteArray out;
+    QLoggerJson::appendString(out, data.constData(), data.size());
+    return out;
+}
+
+/*!
+ *  \brief Stops a running logger when leaving the scope, even after a failed check
+ */
+struct LoggerStopper {
+    QLogger* logger;    //!< the logger to stop
+
+    ~LoggerStopper()
+    {
+        logger->finishWriting();
+        logger->wait();
+    }
+};
+
+}
+
+class TestQLogger : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void jsonEscapes();
+    void jsonEscapesEveryByteAtEveryPosition();
+    void jsonEscapesUnaligned();
+    void frameDecoderSplitInput();
+    void frameDecoderGarbage();
+    void frameDecoderOversize();
+    void histogramPercentiles();
+    void categoryThresholdOrdering();
+    void flushOrdering();
+};
+
+void TestQLogger::jsonEscapes()
+{
+    QCOMPARE(json(QByteArray()), QByteArray("\"\""));
+    QCOMPARE(json(QByteArray("plain text")), QByteArray("\"plain text\""));
+    QCOMPARE(json(QByteArray("a\"b\\c")), QByteArray("\"a\\\"b\\\\c\""));
+    QCOMPARE(json(QByteArray("\n\r\t")), QByteArray("\"\\n\\r\\t\""));
+    QCOMPARE(json(QByteArray("\x00\x01\x1f", 3)), QByteArray("\"\\u0000\\u0001\\u001f\""));
+    QCOMPARE(json(QByteArray("\x7f \xc3\xa9")), QByteArray("\"\x7f \xc3\xa9\""));   // DEL and UTF-8 as they are
+}
+
+void TestQLogger::jsonEscapesEveryByteAtEveryPosition()
+{
+    // lengths across the 32, 16 and 1 byte paths, the byte before, in and after each chunk
+    for (int byte = 0; byte < 256; ++byte) {
+        for (int size = 1; size <= 70; ++size) {
+            for (int position = 0; position < size; ++position) {
+                QByteArray data(size, 'a');
+                data[position] = static_cast<char>(byte);
+
+                const int expected = needsEscape(static_cast<uchar>(byte)) ? position : size;
+                QCOMPARE(QLoggerJson::findEscape(data.constData(), data.size()), expected);
+                QCOMPARE(json(data), referenceJson(data));
+            }
+        }
+    }
+}
+
+void TestQLogger::jsonEscapesUnaligned()
+{
+    QByteArray all;
+    for (int round = 0; round < 3; ++round) {
+        for (int byte = 0; byte < 256; ++byte)
+            all += static_cast<char>(byte);
+    }
+
+    for (int offset = 0; offset < 64; ++offset) {
+        const QByteArray data = all.mid(offset);
+        QCOMPARE(json(data), referenceJson(data));
+    }
+}
+
+void TestQLogger::frameDecoderSplitInput()
+{
+    const QByteArray long_message(1000, 'x');
+
+    QByteArray stream;
+    QLoggerFrameDecoder::encode(&stream, QByteArray("first"), static_cast<int>(QLogger::LogLevel::Info),
+                                Q_INT64_C(1714552200125), QByteArray("net.tls"));
+    QLoggerFrameDecoder::encode(&stream, QByteArray("two\nlines"), static_cast<int>(QLogger::LogLevel::Fatal),
+                                Q_INT64_C(-1));
+    QLoggerFrameDecoder::encode(&stream, long_message, static_cast<int>(QLogger::LogLevel::Debug),
+                                Q_INT64_C(42), QByteArray("db"));
+    QCOMPARE(stream.size(), 3 * QLoggerFrameDecoder::HeaderSize + 5 + 7 + 9 + 1000 + 2);
+
+    // fed a byte at a time, a frame comes out only once complete
+    QLoggerFrameDecoder decoder;
+    QVector<QLoggerFrameDecoder::Frame> frames;
+    QVector<int> completed_at;
+    for (int i = 0; i < stream.size(); ++i) {
+        decoder.append(stream.constData() + i, 1);
+
+        QLoggerFrameDecoder::Frame frame;
+        while (decoder.next(&frame)) {
+            frames.append(frame);
+            completed_at.append(i + 1);
+        }
+    }
+
+    QVERIFY(!decoder.hasError());
+    QCOMPARE(decoder.buffered(), 0);
+    QCOMPARE(frames.size(), 3);
+    QCOMPARE(completed_at.at(0), 16 + 7 + 5);
+    QCOMPARE(completed_at.at(1), 28 + 16 + 9);
+    QCOMPARE(completed_at.at(2), stream.size());
+
+    QCOMPARE(frames.at(0).level, static_cast<int>(QLogger::LogLevel::Info));
+    QCOMPARE(frames.at(0).timestamp, Q_INT64_C(1714552200125));
+    QCOMPARE(frames.at(0).category, QString("net.tls"));
+    QCOMPARE(frames.at(0).message, QByteArray("first"));
+
+    QCOMPARE(frames.at(1).level, static_cast<int>(QLogger::LogLevel::Fatal));
+    QCOMPARE(frames.at(1).timestamp, Q_INT64_C(-1));
+    QCOMPARE(frames.at(1).category, QString());
+    QCOMPARE(frames.at(1).message, QByteArray("two\nlines"));
+
+    QCOMPARE(frames.at(2).level, static_cast<int>(QLogger::LogLevel::Debug));
+    QCOMPARE(frames.at(2).timestamp, Q_INT64_C(42));
+    QCOMPARE(frames.at(2).category, QString("db"));
+    QCOMPARE(frames.at(2).message, long_message);
+
+    // the same stream in two halves
+    decoder.clear();
+    decoder.append(stream.left(stream.size() / 2));
+    decoder.append(stream.mid(stream.size() / 2));
+
+    QLoggerFrameDecoder::Frame frame;
+    int count = 0;
+    while (decoder.next(&frame))
+        ++count;
+    QCOMPARE(count, 3);
+    QCOMPARE(frame.message, long_message);
+}
+
+void TestQLogger::frameDecoderGarbage()
+{
+    QLoggerFrameDecoder::Frame frame;
+
+    QLoggerFrameDecoder decoder;
+    decoder.append(QByteArray(QLoggerFrameDecoder::HeaderSize, '\xff'));
+    QVERIFY(!decoder.next(&frame));
+    QVERIFY(decoder.hasError());
+    QCOMPARE(decoder.errorString(), QString("unknown frame version 255"));
+
+    // stuck on the error, even when a valid frame follows
+    QByteArray valid;
+    QLoggerFrameDecoder::encode(&valid, QByteArray("ok"), static_cast<int>(QLogger::LogLevel::Info), 0);
+    decoder.append(valid);
+    QVERIFY(!decoder.next(&frame));
+
+    // a level out of the enum
+    QByteArray bad_level = valid;
+    bad_level[5] = 9;
+    decoder.clear();
+    decoder.append(bad_level);
+    QVERIFY(!decoder.next(&frame));
+    QCOMPARE(decoder.errorString(), QString("unknown level 9"));
+
+    // clear() starts over
+    decoder.clear();
+    QVERIFY(!decoder.hasError());
+    decoder.append(valid);
+    QVERIFY(decoder.next(&frame));
+    QCOMPARE(frame.message, QByteArray("ok"));
+}
+
+void TestQLogger::frameDecoderOversize()
+{
+    QLoggerFrameDecoder::Frame frame;
+
+    QByteArray largest;
+    QLoggerFrameDecoder::encode(&largest, QByteArray(100, 'x'), static_cast<int>(QLogger::LogLevel::Info), 0);
+    QLoggerFrameDecoder decoder(100);
+    decoder.append(largest);
+    QVERIFY(decoder.next(&frame));
+    QCOMPARE(frame.message.size(), 100);
+
+    // refused from its header, before its body arrives
+    QByteArray oversize;
+    QLoggerFrameDecoder::encode(&oversize, QByteArray(101, 'x'), static_cast<int>(QLogger::LogLevel::Info), 0);
+    decoder.append(oversize.left(QLoggerFrameDecoder::HeaderSize));
+    QVERIFY(!decoder.next(&frame));
+    QVERIFY(decoder.hasError());
+    QCOMPARE(decoder.errorString(), QString("message of 101 bytes, more than 100"));
+
+    // a header claiming 4 GiB
+    decoder.clear();
+    QByteArray huge = largest.left(QLoggerFrameDecoder::HeaderSize);
+    for (int i = 0; i < 4; ++i)
+        huge[i] = '\xff';
+    decoder.append(huge);
+    QVERIFY(!decoder.next(&frame));
+    QCOMPARE(decoder.errorString(), QString("message of 4294967295 bytes, more than 100"));
+}
+
+void TestQLogger::histogramPercentiles()
+{
+    QLoggerHistogram histogram;
+    QCOMPARE(histogram.percentile(50), qint64(0));
+    QCOMPARE(histogram.max(), qint64(0));
+
+    // 1 to 8 fall in exact buckets, 100 in [100, 103] and 1000 in [992, 1023]
+    for (qint64 value = 1; value <= 8; ++value)
+        histogram.record(value);
+    histogram.record(100);
+    histogram.record(1000);
+
+    QCOMPARE(histogram.count(), quint64(10));
+    QCOMPARE(histogram.min(), qint64(1));
+    QCOMPARE(histogram.max(), qint64(1023));
+    QCOMPARE(histogram.percentile(0), qint64(1));
+    QCOMPARE(histogram.percentile(10), qint64(1));
+    QCOMPARE(histogram.percentile(50), qint64(5));
+    QCOMPARE(histogram.percentile(80), qint64(8));
+    QCOMPARE(histogram.percentile(90), qint64(103));
+    QCOMPARE(histogram.percentile(99), qint64(1023));
+    QCOMPARE(histogram.percentile(100), qint64(1023));
+
+    QCOMPARE(QLoggerHistogram::bucketOf(1000), 111);
+    QCOMPARE(QLoggerHistogram::lowerBound(111), qint64(992));
+    QCOMPARE(QLoggerHistogram::upperBound(111), qint64(1023));
+
+    // negative values count as 0
+    QLoggerHistogram other;
+    other.record(-5);
+    histogram.merge(other);
+    QCOMPARE(histogram.count(), quint64(11));
+    QCOMPARE(histogram.min(), qint64(0));
+}
+
+void TestQLogger::categoryThresholdOrdering()
+{
+    QLogger logger(QLogger::stream_ptr(new QLoggerMemoryStream));
+
+    // Debug < Info < Warning < Fatal, whatever the order of the enum
+    QCOMPARE(QLogger::severityRank(QLogger::LogLevel::Debug), 0);
+    QCOMPARE(QLogger::severityRank(QLogger::LogLevel::Info), 1);
+    QCOMPARE(QLogger::severityRank(QLogger::LogLevel::Warning), 2);
+    QCOMPARE(QLogger::severityRank(QLogger::LogLevel::Fatal), 3);
+
+    // everything is enabled by default
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Debug, "net"));
+    QVERIFY(logger.categoryLevel("net") == QLogger::LogLevel::Debug);
+
+    logger.setCategoryLevel("app", QLogger::LogLevel::Debug);
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Debug, "app"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Info, "app"));
+
+    logger.setCategoryLevel("net", QLogger::LogLevel::Info);
+    QVERIFY(!logger.isEnabled(QLogger::LogLevel::Debug, "net"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Info, "net"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Warning, "net"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Fatal, "net"));
+
+    // subcategories inherit, until they have a level of their own
+    QVERIFY(!logger.isEnabled(QLogger::LogLevel::Debug, "net.tls"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Info, "net.tls"));
+
+    QLoggerCategory tls(&logger, "net.tls");
+    QVERIFY(tls.isEnabled(QLogger::LogLevel::Info));
+
+    logger.setCategoryLevel("net.tls", QLogger::LogLevel::Warning);
+    QVERIFY(!tls.isEnabled(QLogger::LogLevel::Info));
+    QVERIFY(tls.isEnabled(QLogger::LogLevel::Warning));
+    QVERIFY(!logger.isEnabled(QLogger::LogLevel::Info, "net.tls.handshake"));
+    QVERIFY(logger.categoryLevel("net.tls.handshake") == QLogger::LogLevel::Warning);
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Info, "net"));
+
+    logger.setCategoryLevel("db", QLogger::LogLevel::Fatal);
+    QVERIFY(!logger.isEnabled(QLogger::LogLevel::Warning, "db"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Fatal, "db"));
+
+    logger.removeCategoryLevel("net.tls");
+    QVERIFY(tls.isEnabled(QLogger::LogLevel::Info));
+    QVERIFY(!tls.isEnabled(QLogger::LogLevel::Debug));
+    QVERIFY(logger.categoryLevel("net.tls") == QLogger::LogLevel::Info);
+
+    // a stream level is compared the same way
+    logger.setStreamLevel(0, QLogger::LogLevel::Warning);
+    QVERIFY(!logger.isEnabled(QLogger::LogLevel::Info, "app"));
+    QVERIFY(logger.isEnabled(QLogger::LogLevel::Fatal, "app"));
+}
+
+void TestQLogger::flushOrdering()
+{
+    QLoggerMemoryStream* memory = new QLoggerMemoryStream;
+    QLogger logger{QLogger::stream_ptr(memory)};
+    logger.setFormatString("%2 %3");
+    logger.start();
+    LoggerStopper stopper = { &logger };
+
+    // formatted by the producer, by the writer (fields) and built by QLoggerRecord, in one queue
+    QByteArray expected;
+    for (int i = 0; i < 100; ++i) {
+        logger.addMessage(QString("message %1").arg(i), QLogger::LogLevel::Info);
+        expected += "INFO message " + QByteArray::number(i) + "\n";
+
+        if (i % 10 == 3) {
+            logger.addMessage("fields", QLogger::LogLevel::Debug, QLoggerFields() << QLoggerField("bytes", i));
+            expected += "DEBUG fields bytes=" + QByteArray::number(i) + "\n";
+        }
+        if (i % 10 == 7) {
+            logger.record(QLogger::LogLevel::Warning) << "record " << i << ' ' << 2.5;
+            expected += "WARNING record " + QByteArray::number(i) + " 2.5\n";
+        }
+    }
+
+    QFuture<bool> flushed = logger.flush();
+    flushed.waitForFinished();
+    QVERIFY(flushed.result());
+    QCOMPARE(memory->data(), expected);
+
+    // a second barrier, syncing the stream, waits for what came since the first one
+    logger.addMessage("after", QLogger::LogLevel::Info);
+    expected += "INFO after\n";
+    QFuture<bool> synced = logger.flush(true);
+    synced.waitForFinished();
+    QVERIFY(synced.result());
+    QCOMPARE(memory->data(), expected);
+}
+
+QTEST_GUILESS_MAIN(TestQLogger)
+
+#include "tst_qlogger.moc"